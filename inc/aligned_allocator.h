@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+// Allocator that places the start of every allocation on its own cache line, used for the structure-of-arrays
+// tables that are read in the hit loop so that a column never shares a line with anything else
+template <class T, std::size_t Alignment = 64> struct CacheAlignedAllocator {
+    using value_type = T;
+
+    template <class U> struct rebind {
+        using other = CacheAlignedAllocator<U, Alignment>;
+    };
+
+    CacheAlignedAllocator() = default;
+    template <class U> CacheAlignedAllocator(const CacheAlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(std::size_t n) {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T *p, std::size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <class U> bool operator==(const CacheAlignedAllocator<U, Alignment> &) const { return true; }
+    template <class U> bool operator!=(const CacheAlignedAllocator<U, Alignment> &) const { return false; }
+};
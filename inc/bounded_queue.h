@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+// Fixed capacity multi-producer, multi-consumer queue without locks, after Dmitry Vyukov's bounded queue: every
+// cell carries a sequence number that tells producers and consumers whose turn it is, so a push or a pop is a
+// compare-and-swap on the head or the tail and never waits for another thread to finish its operation. The
+// capacity is rounded up to a power of two and the cells are allocated once, so the queue never allocates after
+// it is built.
+//
+// push and pop block while the queue is full or empty, which is the back pressure between the stages of a pipeline.
+// They retry for a short spin first, which covers the other side catching up within a few hundred cycles, and then
+// sleep on a condition variable until the other side has made room or pushed an item, so a stage that waits on a
+// slow reader or a slow aggregator does not take a core from the stages that have work. The mutex is only taken
+// by threads that go to sleep and by those that wake them, a push or a pop that finds nobody asleep does not touch
+// it. Once close() is called pop returns false as soon as the queue is empty, so consumers can drain it and stop.
+template <class T> class BoundedQueue {
+  public:
+    explicit BoundedQueue(std::size_t capacity) {
+        std::size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        mask = size - 1;
+        cells = std::make_unique<Cell[]>(size);
+        for (std::size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    std::size_t capacity() const { return mask + 1; }
+
+    // Returns false, without waiting, if the queue is full
+    bool tryPush(const T &item) {
+        std::size_t position = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = cells[position & mask];
+            std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            std::intptr_t difference = std::intptr_t(sequence) - std::intptr_t(position);
+            if (difference == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.item = item;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Returns false, without waiting, if the queue is empty
+    bool tryPop(T &item) {
+        std::size_t position = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = cells[position & mask];
+            std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            std::intptr_t difference = std::intptr_t(sequence) - std::intptr_t(position + 1);
+            if (difference == 0) {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    item = cell.item;
+                    cell.sequence.store(position + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Waits while the queue is full
+    void push(const T &item) {
+        bool pushed = false;
+        for (int spin = 0; spin < spinLimit && !(pushed = tryPush(item)); spin++) {
+        }
+        if (!pushed) {
+            sleepUntil(notFull, sleepingProducers, [&]() { return tryPush(item); });
+        }
+        wake(notEmpty, sleepingConsumers);
+    }
+
+    // Waits while the queue is empty and open, returns false once it is empty and closed
+    bool pop(T &item) {
+        bool popped = false;
+        for (int spin = 0; spin < spinLimit && !(popped = tryPop(item)); spin++) {
+            if (closed.load(std::memory_order_acquire)) {
+                break;
+            }
+        }
+        if (!popped) {
+            sleepUntil(notEmpty, sleepingConsumers,
+                  [&]() { return (popped = tryPop(item)) || closed.load(std::memory_order_acquire); });
+            // Items pushed before close() are still taken
+            popped = popped || tryPop(item);
+        }
+        if (popped) {
+            wake(notFull, sleepingProducers);
+        }
+        return popped;
+    }
+
+    // Marks the end of the items, no more may be pushed
+    void close() {
+        closed.store(true, std::memory_order_release);
+        wake(notEmpty, sleepingConsumers);
+    }
+
+  private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T item;
+    };
+
+    // Attempts before a blocked push or pop goes to sleep
+    static constexpr int spinLimit = 256;
+
+    // The sleeper counts itself before it checks the queue a last time and the waker checks the count after it has
+    // changed the queue, with a full fence between on both sides, so either the sleeper sees the change or the
+    // waker sees the sleeper. The waker takes the mutex before notifying, so the sleeper cannot miss it between
+    // that check and going to sleep.
+    template <class Ready>
+    void sleepUntil(std::condition_variable &condition, std::atomic<int> &sleeping, const Ready &ready) {
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        condition.wait(lock, ready);
+        sleeping.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void wake(std::condition_variable &condition, const std::atomic<int> &sleeping) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            condition.notify_all();
+        }
+    }
+
+    // The head and the tail are on their own cache lines so that producers and consumers do not share one
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+    alignas(64) std::atomic<bool> closed{false};
+    std::atomic<int> sleepingProducers{0};
+    std::atomic<int> sleepingConsumers{0};
+    std::size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
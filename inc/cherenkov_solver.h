@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "physics_constants.h"
+
+// Batch solver for the point along a muon track at which the Cherenkov light seen by a PMT was emitted.
+//
+// For a hit at position x at time t and a muon that enters at e at time t0 travelling along the unit vector d,
+// with r = x - e, the emission distance s along the track solves
+//     a s^2 + b s + c = 0
+//     a = 1 / ng^2 - 1
+//     b = 2 (r.d - cVac (t - t0) / ng^2)
+//     c = cVac^2 (t - t0)^2 / ng^2 - |r|^2
+// which is the same equation that quadraticFormula, calculateA, calculateB and calculateC set up one hit at a time.
+
+// The terms of the equation that only depend on the constants, folded at compile time
+constexpr double solverA = 1 / (ng * ng) - 1;
+constexpr double solverInverseTwoA = 1 / (2 * solverA);
+constexpr double solverFourA = 4 * solverA;
+constexpr double solverTwoCOverNg2 = 2 * cVac / (ng * ng);
+constexpr double solverC2OverNg2 = cVac * cVac / (ng * ng);
+
+struct MuonTrack {
+    double entry[3]; // cm
+    double dir[3];   // unit vector
+    double time;     // ns
+};
+
+// Structure-of-arrays view of the hits to solve, the arrays are owned by the caller
+struct HitBatch {
+    const double *x;
+    const double *y;
+    const double *z;
+    const double *t;
+    std::size_t size;
+};
+
+// Caller provided output buffers, each must hold at least HitBatch::size elements. For every hit nRoots is 0 when
+// there is no real solution (both roots are then NaN), 1 when the discriminant is exactly zero (both roots hold
+// the single solution) and 2 otherwise. discriminant is optional and is only written when it is not null.
+struct SolverOutput {
+    double *rootPlus;  // (-b + sqrt(discriminant)) / 2a
+    double *rootMinus; // (-b - sqrt(discriminant)) / 2a
+    std::uint8_t *nRoots;
+    double *discriminant;
+};
+
+// Discriminants below this are counted as near zero, the two roots are then close to degenerate
+constexpr double nearZeroDiscriminant = 100;
+
+// Summary of the discriminants seen by the solver, collected in place of printing them hit by hit
+struct DiscriminantCounters {
+    std::uint64_t negative = 0; // No real root
+    std::uint64_t zero = 0;     // Exactly one root
+    std::uint64_t twoRoots = 0;
+    std::uint64_t nearZero = 0; // The part of twoRoots below nearZeroDiscriminant
+
+    void add(double discriminant) {
+        negative += discriminant < 0;
+        zero += discriminant == 0;
+        twoRoots += discriminant > 0;
+        nearZero += discriminant > 0 && discriminant < nearZeroDiscriminant;
+    }
+    void add(const double *discriminants, std::size_t n);
+    void merge(const DiscriminantCounters &other);
+};
+
+enum class SolverPath { Scalar, AVX2, AVX512 };
+
+// Solves every hit in the batch against one track using the fastest path supported by the CPU
+void solveEmissionPoints(const MuonTrack &track, const HitBatch &hits, const SolverOutput &out);
+// Solves every hit in the batch using the requested path, which must be supported by the CPU
+void solveEmissionPoints(const MuonTrack &track, const HitBatch &hits, const SolverOutput &out, SolverPath path);
+// Solves every hit in the batch against each of several tracks, out[k] receives the solutions for tracks[k]. Each
+// block of hits is loaded once and solved against a group of tracks with their parameters held in registers, so
+// an event with a few muons costs little more to solve than one with a single muon.
+void solveEmissionPoints(const MuonTrack *tracks, std::size_t nTracks, const HitBatch &hits, const SolverOutput *out,
+                         SolverPath path);
+
+// The default path, AVX2 where the CPU supports it
+SolverPath bestSolverPath();
+bool solverPathSupported(SolverPath path);
+const char *solverPathName(SolverPath path);
+// Parses scalar, avx2 or avx512, returns false if the name is not one of them
+bool parseSolverPath(const std::string &name, SolverPath &path);
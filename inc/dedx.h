@@ -1,15 +1,31 @@
+#include <cstddef>
+#include <cstdint>
+#include <string>
 #include <vector>
 
+#include "RtypesCore.h"
+
+class EventPipeline;
+class SkimReader;
+struct EventView;
+struct JobInput;
+struct MuonKinematics;
+struct PipelineReader;
+struct SolveCachePiece;
+struct WorkerResult;
+
 int main(int argc, char **argv);
 
-// Quadtratic formula stuff
-std::vector<double> quadraticFormula(double a, double b, double c);
-double getDiscriminant(double a, double b, double c);
-double calculateA();
-double calculateB(double muonToHit[3], double muonEntry[3], double HitTime, double muonEntryTime);
-double calculateC(double magnitudeR, double hitTime, double muonEntryTime);
-double calculateZ(double longDist, double muonToHit[3], double muonDir[3]);
-double calculateT(double longDist, double muonToHit[3], double muonDir[3]);
-
-constexpr double cVac = 29.9792458; // cm/ns
-constexpr double ng = 1.38;         // Group refractive index in water for Cherenkov light
+// Event loop
+void processRange(const std::vector<JobInput> &inputs, Long64_t firstEntry, Long64_t lastEntry,
+                  WorkerResult &result);
+bool processEntries(std::string WCSimFilePath, Long64_t firstEntry, Long64_t lastEntry, WorkerResult &result);
+bool processSkimEvents(const SkimReader &reader, Long64_t firstEvent, Long64_t lastEvent, WorkerResult &result);
+void readEvents(const std::vector<JobInput> &inputs, Long64_t firstEntry, Long64_t lastEntry, EventPipeline &pipeline,
+                PipelineReader &reader);
+void solveEvents(EventPipeline &pipeline, WorkerResult &result);
+bool replaySolutions(const std::vector<SolveCachePiece> &pieces, Long64_t firstEntry, Long64_t lastEntry,
+                     WorkerResult &result);
+void processEvent(const EventView &event, WorkerResult &result);
+void useSolvedHits(std::int64_t entry, std::size_t nHits, const MuonKinematics *muons, std::size_t nMuons,
+                   WorkerResult &result);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "flat_event.h"
+
+// Online mean and variance using Welford's algorithm. Two accumulators can be merged, so partial results from
+// different workers or jobs combine into the same answer as a single pass up to rounding.
+struct RunningStats {
+    std::uint64_t count = 0;
+    double mean = 0;
+    double m2 = 0; // Sum of squared differences from the mean
+    double min = 0;
+    double max = 0;
+
+    void add(double x);
+    void merge(const RunningStats &other);
+    double variance() const { return count > 1 ? m2 / (count - 1) : 0; }
+    double rms() const;
+};
+
+// Adds the truncated mean of a track to the statistics, unless the track had none. Adding the tracks of a job in
+// entry order gives the same statistics however the entries were split between threads.
+inline void addTruncatedMean(RunningStats &stats, double truncatedMean) {
+    if (!std::isnan(truncatedMean)) {
+        stats.add(truncatedMean);
+    }
+}
+
+// One dE/dx measurement, made for each muon track. Charges are in p.e. and lengths in cm.
+struct DedxRecord {
+    std::int64_t entry;
+    std::uint32_t muonIndex;
+    double energy;
+    double trackLength;
+    std::uint32_t nHits; // Hits with at least one emission point on the track
+    double totalCharge;
+    std::uint32_t nBins; // Bins along the track that collected charge
+    double meanDqdx;
+    double rmsDqdx;
+    double truncatedMeanDqdx;
+};
+
+struct DedxEstimatorConfig {
+    double binWidth = 50;            // cm
+    double truncationFraction = 0.3; // Fraction of the highest charge bins dropped from the truncated mean
+};
+
+// Streaming dE/dx estimator. The charge of each hit is binned along the muon track at its reconstructed emission
+// point, and at the end of the track the charge per unit length of the bins is reduced to a mean, an RMS and a
+// truncated mean. The number of bins is capped, so the memory used does not depend on the number of hits, tracks
+// or events.
+class DedxEstimator {
+  public:
+    static constexpr std::size_t maxBins = 512;
+
+    explicit DedxEstimator(const DedxEstimatorConfig &config = DedxEstimatorConfig());
+
+    void beginTrack(std::int64_t entry, std::uint32_t muonIndex, const MuonKinematics &muon);
+    // Adds the charge of a hit given its two candidate emission distances along the track. Candidates that fall
+    // outside of the track are ignored and the charge is shared equally between the remaining ones.
+    void addHit(double charge, const double *emissionDistances, std::size_t nCandidates);
+    DedxRecord endTrack();
+
+    // Statistics of the truncated mean over every track that has ended so far
+    const RunningStats &runStats() const { return run; }
+
+  private:
+    DedxEstimatorConfig config;
+    std::array<double, maxBins> binCharge;
+    std::size_t nBins = 0;
+    double binWidth = 0;
+    DedxRecord record = {};
+    RunningStats run;
+};
+
+void writeDedxRecordHeader(std::ostream &stream);
+void writeDedxRecord(std::ostream &stream, const DedxRecord &record);
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cherenkov_solver.h"
+#include "dedx_estimator.h"
+#include "flat_event.h"
+#include "hit_preselection.h"
+#include "pmt_geometry.h"
+
+// The hits of one event gathered into structure-of-arrays form, together with their emission points along the
+// tracks they were last solved against. Hits whose tube ID is not in the geometry are left out, so row i is not
+// necessarily hit i of the event.
+//
+// The solutions are stored track after track: those of hit i for track k are at k * size() + i, so the columns of
+// the first track are the same as when a single track is solved.
+struct SolvedHits {
+    AlignedVector<double> x, y, z; // cm, position of the PMT
+    AlignedVector<double> t;       // ns
+    AlignedVector<double> charge;  // p.e.
+    std::size_t nTracks = 0;
+    AlignedVector<double> rootPlus, rootMinus;
+    AlignedVector<std::uint8_t> nRoots;
+    AlignedVector<double> discriminant; // Only filled when DedxReconstructorConfig::keepDiscriminants is set
+    // Whether the hit is in the preselection window of the track, laid out as the solutions. Empty when every hit
+    // belongs to every track, which is the case whenever the hits were gathered for a single track.
+    AlignedVector<std::uint8_t> inWindow;
+
+    std::size_t size() const { return t.size(); }
+    bool onTrack(std::size_t track, std::size_t hit) const {
+        return inWindow.empty() || inWindow[track * size() + hit];
+    }
+};
+
+struct DedxReconstructorConfig {
+    DedxEstimatorConfig estimator;
+    PreselectionConfig preselection;
+    SolverPath solverPath = bestSolverPath();
+    bool keepDiscriminants = false;
+};
+
+// The whole per event dE/dx reconstruction: looks up the PMT of every hit, solves the emission points against a
+// muon track and bins the charge along the track. It needs nothing but a PMT geometry and events in the flat
+// EventView form, so it can be used without ROOT or WCSim. The buffers are reused from one event to the next, so
+// once they have grown to the largest event the reconstruction does not allocate. An instance is not thread safe,
+// use one per thread; they can all share one geometry.
+class DedxReconstructor {
+  public:
+    explicit DedxReconstructor(const PMTGeometry &geometry,
+                               const DedxReconstructorConfig &config = DedxReconstructorConfig());
+
+    // Gathers the positions, times and charges of the event's hits
+    const SolvedHits &gather(const EventView &event);
+    // Gathers only the hits that can be direct light from the muon, unless preselection is disabled
+    const SolvedHits &gather(const EventView &event, const MuonKinematics &muon);
+    // Gathers the hits that can be direct light from any of the muons and marks which muons each one can belong to
+    const SolvedHits &gather(const EventView &event, const MuonKinematics *muons, std::size_t nMuons);
+    // Solves the gathered hits against the track
+    const SolvedHits &solve(const MuonTrack &track);
+    // Solves the gathered hits against every muon in one pass over the hits
+    const SolvedHits &solve(const MuonKinematics *muons, std::size_t nMuons);
+    // Measures the dE/dx of the muon from the hits as last solved, using the solutions of the given track, which
+    // must be this muon
+    DedxRecord measure(std::int64_t entry, std::uint32_t muonIndex, const MuonKinematics &muon,
+                       std::size_t track = 0);
+
+    // Gathers and solves the event against one of its muons and measures its dE/dx
+    DedxRecord reconstruct(const EventView &event, std::size_t muonIndex);
+    // Reconstructs every muon of the event, gathering the hits once and solving them against all of the muons
+    // together, and appends one record per muon. Gives the same records as reconstructing the muons one by one.
+    std::size_t reconstruct(const EventView &event, std::vector<DedxRecord> &records);
+    // Reconstructs every muon of every event in the batch, appending one record per muon in event order. Returns
+    // the number of records added.
+    std::size_t reconstruct(const EventView *events, std::size_t nEvents, std::vector<DedxRecord> &records);
+
+    const SolvedHits &hits() const { return solved; }
+    // The hits to measure, to be filled with hits solved earlier, for example read back from a solve cache, in
+    // place of gathering and solving them again
+    SolvedHits &restoreHits() { return solved; }
+    const PreselectionCounters &preselectionCounters() const { return counters; }
+    // Counts the preselection of restored hits as it was counted when they were gathered
+    void restorePreselectionCounters(const PreselectionCounters &restored) { counters.merge(restored); }
+    // Statistics of the truncated mean over every track measured so far
+    const RunningStats &runStats() const { return estimator.runStats(); }
+
+  private:
+    // Gathers the hits on known PMTs with times in [begin, end]
+    void gatherWindow(const EventView &event, double begin, double end);
+    const SolvedHits &solveTracks(std::size_t nTracks);
+
+    const PMTGeometry &geometry;
+    DedxReconstructorConfig config;
+    SolvedHits solved;
+    std::vector<MuonTrack> tracks;
+    std::vector<SolverOutput> outputs;
+    // The event windows and lengths of the muons of the event being gathered
+    std::vector<double> windowBegins, windowEnds, trackLengths;
+    DedxEstimator estimator;
+    HitPreselector preselector;
+    PreselectionCounters counters;
+};
+
+MuonTrack muonTrack(const MuonKinematics &muon);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+
+#include "physics_constants.h"
+
+// The emission point equation set up and solved one hit at a time. solveEmissionPoints in cherenkov_solver.h
+// solves the same equation for a whole batch of hits.
+
+// Quadtratic formula stuff
+std::vector<double> quadraticFormula(double a, double b, double c);
+double getDiscriminant(double a, double b, double c);
+double calculateA();
+double calculateB(double muonToHit[3], double muonEntry[3], double HitTime, double muonEntryTime);
+double calculateC(double magnitudeR, double hitTime, double muonEntryTime);
+
+// How calculateZ and calculateT evaluate the angle between the muon and the hit. The exact path takes
+// sin(acos(cos theta)) and the tangent and sine of the Cherenkov angle with the library functions on every call, as
+// it always has. The fast path uses sin theta = sqrt(1 - cos^2 theta), one square root and no transcendental
+// function, and takes the Cherenkov angle terms from constants computed at compile time. It is about 5 times
+// faster. Over the hits of the synthetic events of the benchmark the two paths differ by at most 3e-9 cm in z and
+// 2e-10 ns in t, from hits close to the track axis where both lose precision; bin/bench reports the difference on
+// its sample. Where rounding puts |cos theta| just above 1, the exact path gives NaN and the fast path treats the
+// hit as on the track axis.
+enum class FormulaPath { Exact, Fast };
+const char *formulaPathName(FormulaPath path);
+
+double calculateZ(double longDist, double muonToHit[3], double muonDir[3], FormulaPath path = FormulaPath::Exact);
+double calculateT(double longDist, double muonToHit[3], double muonDir[3], FormulaPath path = FormulaPath::Exact);
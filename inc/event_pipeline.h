@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "dedx_estimator.h"
+#include "flat_event.h"
+
+// The plumbing of a three stage event pipeline: a reader that decodes events, any number of solvers that
+// reconstruct them and an aggregator that takes the results in event order. The stages run on their own threads
+// and are joined by bounded queues, so reading the next events overlaps with solving the last ones, and a stage
+// that gets ahead sleeps until the others catch up instead of piling up events.
+//
+// The events travel in slots from a pool that is allocated once. A slot goes from the reader to a solver, from
+// the solver to the aggregator and from the aggregator back to the reader, and its buffers keep their capacity on
+// the way, so once they have grown to the largest event the pipeline does not allocate. The number of slots
+// bounds the number of events in flight, and the aggregator puts the events that the solvers finish out of order
+// back in order in a reorder buffer of the same size.
+
+struct PipelineSlot {
+    std::uint64_t sequence = 0; // Order in which the reader filled the slot
+    FlatEvent event;
+    std::vector<DedxRecord> records; // Filled by the solver
+};
+
+class EventPipeline {
+  public:
+    EventPipeline(std::size_t nSlots, std::size_t nSolvers);
+    EventPipeline(const EventPipeline &) = delete;
+    EventPipeline &operator=(const EventPipeline &) = delete;
+
+    // Reader: takes a free slot, waiting for one if they are all in flight, and hands it to the solvers once its
+    // event is decoded. finishReading() is called once after the last event.
+    PipelineSlot *acquire();
+    void submit(PipelineSlot *slot);
+    void finishReading();
+
+    // Solvers: take the next event to reconstruct, nullptr once the reader has finished and every event has been
+    // taken, and pass it on to the aggregator. Each solver calls finishSolving() once it has stopped.
+    PipelineSlot *take();
+    void complete(PipelineSlot *slot);
+    void finishSolving();
+
+    // Aggregator: takes the reconstructed events in the order they were read, nullptr once they have all been
+    // taken, and releases each slot back to the reader when it is done with it
+    PipelineSlot *next();
+    void release(PipelineSlot *slot);
+
+  private:
+    std::vector<PipelineSlot> slots;
+    BoundedQueue<PipelineSlot *> freeSlots;
+    BoundedQueue<PipelineSlot *> toSolve;
+    BoundedQueue<PipelineSlot *> solved;
+    std::atomic<std::size_t> activeSolvers;
+    // Only used by the reader
+    std::uint64_t nextToRead = 0;
+    // Only used by the aggregator, slot sequence % slots.size() holds the event until its turn
+    std::vector<PipelineSlot *> reorder;
+    std::uint64_t nextInOrder = 0;
+};
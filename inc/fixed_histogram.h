@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+// Fixed-bin histograms for the hit loops. The number of bins is a template parameter and the axes are uniform, so
+// a fill is a subtraction, a division and an add into a flat array, with no virtual call and no allocation. Each
+// thread fills its own histogram, a shard, and the shards are merged once the threads have finished, so no locking
+// is needed. They are converted into ROOT histograms with the same binning only when the results are written, see
+// fixed_histogram_root.h.
+//
+// The bins follow ROOT's conventions so that the conversion gives exactly the bins that ROOT would have filled: bin
+// 0 is the underflow and bin N + 1 the overflow, the bin of x is found with the same expression as TAxis::FindBin
+// and NaN goes to the overflow. Only the counts and the number of entries are kept, the mean and RMS are computed
+// from the bins once converted, as TH1::ResetStats does, so they do not depend on how the fills were split.
+
+// A uniform axis of N bins over [low, high)
+template <std::size_t N> struct FixedAxis {
+    double low;
+    double high;
+
+    std::size_t bin(double x) const {
+        if (x < low) {
+            return 0;
+        }
+        if (!(x < high)) {
+            return N + 1;
+        }
+        std::size_t bin = 1 + std::size_t(N * (x - low) / (high - low));
+        return bin > N ? N : bin;
+    }
+};
+
+template <std::size_t NX> class FixedHistogram1D {
+  public:
+    static constexpr std::size_t nBinsX = NX;
+
+    FixedHistogram1D(double low, double high) : axis{low, high} { clear(); }
+
+    void fill(double x) {
+        counts[axis.bin(x)] += 1;
+        entries += 1;
+    }
+
+    void merge(const FixedHistogram1D &other) {
+        for (std::size_t bin = 0; bin < counts.size(); bin++) {
+            counts[bin] += other.counts[bin];
+        }
+        entries += other.entries;
+    }
+
+    void clear() {
+        counts.fill(0);
+        entries = 0;
+    }
+
+    const FixedAxis<NX> &xAxis() const { return axis; }
+    // Bin 0 is the underflow and bin NX + 1 the overflow
+    double count(std::size_t bin) const { return counts[bin]; }
+    double nEntries() const { return entries; }
+
+  private:
+    FixedAxis<NX> axis;
+    std::array<double, NX + 2> counts;
+    double entries;
+};
+
+template <std::size_t NX, std::size_t NY> class FixedHistogram2D {
+  public:
+    static constexpr std::size_t nBinsX = NX;
+    static constexpr std::size_t nBinsY = NY;
+
+    FixedHistogram2D(double lowX, double highX, double lowY, double highY) : axisX{lowX, highX}, axisY{lowY, highY} {
+        clear();
+    }
+
+    void fill(double x, double y) {
+        counts[axisY.bin(y) * (NX + 2) + axisX.bin(x)] += 1;
+        entries += 1;
+    }
+
+    void merge(const FixedHistogram2D &other) {
+        for (std::size_t bin = 0; bin < counts.size(); bin++) {
+            counts[bin] += other.counts[bin];
+        }
+        entries += other.entries;
+    }
+
+    void clear() {
+        counts.fill(0);
+        entries = 0;
+    }
+
+    const FixedAxis<NX> &xAxis() const { return axisX; }
+    const FixedAxis<NY> &yAxis() const { return axisY; }
+    // Bins 0 and N + 1 of each axis are its underflow and overflow
+    double count(std::size_t binX, std::size_t binY) const { return counts[binY * (NX + 2) + binX]; }
+    double nEntries() const { return entries; }
+
+  private:
+    FixedAxis<NX> axisX;
+    FixedAxis<NY> axisY;
+    std::array<double, (NX + 2) * (NY + 2)> counts;
+    double entries;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#include "TAxis.h"
+#include "TH1.h"
+
+#include "fixed_histogram.h"
+
+// Conversion of the fixed-bin histograms into ROOT histograms, only needed where the results are written
+
+// Whether a ROOT axis has the same uniform binning as a fixed one
+template <std::size_t N> bool sameBinning(const TAxis &rootAxis, const FixedAxis<N> &axis) {
+    return rootAxis.GetNbins() == int(N) && !rootAxis.IsVariableBinSize() && rootAxis.GetXmin() == axis.low &&
+           rootAxis.GetXmax() == axis.high;
+}
+
+// Adds unweighted counts to a bin, and to its sum of squared weights if the histogram keeps one. SetBinContent
+// invalidates the statistics, so the callers recompute them afterwards.
+inline void addToBin(TH1 &hist, int bin, double count) {
+    if (hist.GetSumw2N()) {
+        double error = hist.GetBinError(bin);
+        hist.SetBinError(bin, std::sqrt(error * error + count));
+    }
+    hist.SetBinContent(bin, hist.GetBinContent(bin) + count);
+}
+
+// Recomputes the statistics of a histogram from its bins, keeping the number of entries, which ResetStats would set
+// to the sum of the in-range bins
+inline void resetStats(TH1 &hist, double entries) {
+    hist.ResetStats();
+    hist.SetEntries(entries);
+}
+
+// Adds a fixed-bin histogram into a TH1 with the same binning, the statistics are recomputed from the bins. Returns
+// false, leaving the histogram as it was, if the binning differs.
+template <std::size_t NX> bool addToROOT(const FixedHistogram1D<NX> &histogram, TH1 &hist) {
+    if (!sameBinning(*hist.GetXaxis(), histogram.xAxis())) {
+        return false;
+    }
+    double entries = hist.GetEntries();
+    for (std::size_t bin = 0; bin <= NX + 1; bin++) {
+        addToBin(hist, bin, histogram.count(bin));
+    }
+    resetStats(hist, entries + histogram.nEntries());
+    return true;
+}
+
+// Adds a fixed-bin histogram into a TH2 with the same binning
+template <std::size_t NX, std::size_t NY> bool addToROOT(const FixedHistogram2D<NX, NY> &histogram, TH1 &hist) {
+    if (!sameBinning(*hist.GetXaxis(), histogram.xAxis()) || !sameBinning(*hist.GetYaxis(), histogram.yAxis())) {
+        return false;
+    }
+    double entries = hist.GetEntries();
+    for (std::size_t binY = 0; binY <= NY + 1; binY++) {
+        for (std::size_t binX = 0; binX <= NX + 1; binX++) {
+            addToBin(hist, hist.GetBin(binX, binY), histogram.count(binX, binY));
+        }
+    }
+    resetStats(hist, entries + histogram.nEntries());
+    return true;
+}
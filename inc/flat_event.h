@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Kinematics of a muon track, all that the dE/dx reconstruction needs to know about it
+struct MuonKinematics {
+    double start[3]; // cm
+    double stop[3];  // cm
+    double dir[3];   // unit vector
+    double time;     // ns
+    double energy;   // MeV
+    double momentum; // MeV
+};
+
+// Non-owning view of one event: its muon tracks and its digitised hits as parallel columns. Views can point into
+// a FlatEvent or straight into a memory-mapped skim file.
+struct EventView {
+    std::int64_t entry;
+    const MuonKinematics *muons;
+    std::size_t nMuons;
+    const std::int32_t *tubeId;
+    const double *time;  // ns, kept in double as the solutions near the Cherenkov minimum depend on its rounding
+    const float *charge; // p.e.
+    std::size_t nHits;
+};
+
+// An event decoded into flat, reusable buffers. clear() keeps the capacity of the buffers, so once they have grown
+// to the size of the largest event decoding another event does not allocate.
+struct FlatEvent {
+    std::int64_t entry = -1;
+    std::vector<MuonKinematics> muons;
+    std::vector<std::int32_t> tubeId;
+    std::vector<double> time;
+    std::vector<float> charge;
+
+    void clear() {
+        entry = -1;
+        muons.clear();
+        tubeId.clear();
+        time.clear();
+        charge.clear();
+    }
+
+    EventView view() const {
+        return {entry, muons.data(), muons.size(), tubeId.data(), time.data(), charge.data(), tubeId.size()};
+    }
+};
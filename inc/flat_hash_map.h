@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Open addressing hash map for small integer keys, such as PDG codes and process IDs, that are counted once per
+// track. The keys and values are stored side by side in one array whose size is a power of two, collisions are
+// resolved by linear probing and the table doubles when it is more than half full, so a lookup is a multiply, a
+// shift and usually a single cache line. There is no erase, the maps are only ever added to and merged.
+template <class Key, class Value> class FlatHashMap {
+  public:
+    explicit FlatHashMap(std::size_t capacity = 16) { rehash(capacity); }
+
+    // Returns the value of the key, inserting a value initialised one first if the key is new
+    Value &operator[](const Key &key) {
+        std::size_t slot = findSlot(key);
+        if (!slots[slot].used) {
+            if (2 * (count + 1) > slots.size()) {
+                rehash(2 * slots.size());
+                slot = findSlot(key);
+            }
+            slots[slot].used = true;
+            slots[slot].key = key;
+            slots[slot].value = Value();
+            count++;
+        }
+        return slots[slot].value;
+    }
+
+    // Returns nullptr if the key is not in the map
+    const Value *find(const Key &key) const {
+        const Slot &slot = slots[findSlot(key)];
+        return slot.used ? &slot.value : nullptr;
+    }
+
+    // Calls function(key, value) for every entry, in no particular order
+    template <class Function> void forEach(Function &&function) const {
+        for (const Slot &slot : slots) {
+            if (slot.used) {
+                function(slot.key, slot.value);
+            }
+        }
+    }
+
+    // Adds the values of the other map to the values of the same keys in this one
+    void merge(const FlatHashMap &other) {
+        other.forEach([this](const Key &key, const Value &value) { (*this)[key] += value; });
+    }
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+  private:
+    struct Slot {
+        Key key;
+        Value value;
+        bool used;
+    };
+
+    // Fibonacci hashing, the multiply spreads consecutive keys over the whole table
+    std::size_t findSlot(const Key &key) const {
+        std::size_t mask = slots.size() - 1;
+        std::size_t slot = (std::uint64_t(key) * 0x9E3779B97F4A7C15ull) >> shift;
+        while (slots[slot].used && !(slots[slot].key == key)) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void rehash(std::size_t capacity) {
+        std::size_t size = 2;
+        shift = 63;
+        while (size < capacity) {
+            size *= 2;
+            shift--;
+        }
+        std::vector<Slot> old(size, Slot{Key(), Value(), false});
+        old.swap(slots);
+        count = 0;
+        for (const Slot &slot : old) {
+            if (slot.used) {
+                (*this)[slot.key] = slot.value;
+            }
+        }
+    }
+
+    std::vector<Slot> slots;
+    std::size_t count = 0;
+    int shift = 63;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cherenkov_solver.h"
+#include "flat_event.h"
+#include "pmt_geometry.h"
+
+// Rejects the hits that cannot be direct Cherenkov light from a muon track before any emission point is solved
+// for. A muon that enters at e at time t0 and travels at the speed of light along d for a length L emits light at
+// distance s along the track that reaches a PMT at x at
+//     t(s) = t0 + (s + ng |x - e - s d|) / cVac
+// This is convex in s, so the direct light from the track reaches the PMT in a window bounded below by its
+// minimum, the Cherenkov cone time t0 + (z + rho sqrt(ng^2 - 1)) / cVac with z and rho the distances along and
+// across the track, and above by the later of t(0) and t(L). The window is widened by a margin on both sides for
+// the time resolution and tested with squared comparisons, so rejecting a hit costs no sqrt.
+//
+// Hits earlier than the cone time would give the quadratic a negative discriminant, and hits later than the
+// window, such as scattered or reflected light and most dark noise, give roots that lie off the track.
+
+struct PreselectionConfig {
+    // Off by default: checking a hit costs about as much as solving it, so preselection only pays off when a large
+    // share of the hits are noise or late light
+    bool enabled = false;
+    double margin = 5;     // ns, added to both sides of every window
+    double timeOffset = 0; // ns, added to the predicted times, for hit times measured from another origin
+};
+
+struct PreselectionCounters {
+    std::uint64_t nHits = 0;              // Hits looked at
+    std::uint64_t outsideEventWindow = 0; // Rejected by the time window of the whole event
+    std::uint64_t outsideConeWindow = 0;  // Rejected by the window of their own PMT
+
+    std::uint64_t kept() const { return nHits - outsideEventWindow - outsideConeWindow; }
+    void merge(const PreselectionCounters &other);
+    // The counts added since the counters were at earlier
+    PreselectionCounters since(const PreselectionCounters &earlier) const;
+};
+
+class HitPreselector {
+  public:
+    // The path picks the instruction set, as for the solver, and must be supported by the CPU
+    HitPreselector(const PMTGeometry &geometry, const PreselectionConfig &config,
+                   SolverPath path = bestSolverPath());
+
+    // The window of hit times in which direct light from the track can reach any PMT of the detector, a single
+    // comparison on the hit time that needs no geometry lookup
+    void eventWindow(const MuonTrack &track, double trackLength, double &begin, double &end) const;
+    // Sets keepHit[i] to 1 if hit i falls in the window of its own PMT and to 0 if not
+    void coneMask(const MuonTrack &track, double trackLength, const double *x, const double *y, const double *z,
+                  const double *t, std::uint8_t *keepHit, std::size_t nHits) const;
+    // Keeps only the hits that fall in the window of their own PMT. The hit columns are compacted in place,
+    // preserving the order of the kept hits, and the number kept is returned.
+    std::size_t selectCone(const MuonTrack &track, double trackLength, double *x, double *y, double *z, double *t,
+                           double *charge, std::size_t nHits);
+
+    const PreselectionConfig &config() const { return settings; }
+
+  private:
+    PreselectionConfig settings;
+    SolverPath path;
+    double detectorSpan = 0; // cm, diagonal of the box around every PMT, the furthest light can travel
+    AlignedVector<std::uint8_t> keep;
+};
+
+double trackLength(const MuonKinematics &muon);
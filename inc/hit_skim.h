@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "flat_event.h"
+
+// Compact columnar file holding only what the dE/dx reconstruction reads from a WCSim file: the muon kinematics of
+// every event and the tube ID, time and charge of every digitised hit.
+//
+// The file is a header followed by clusters of consecutive events. Each cluster holds an event table, the muon
+// table and one column per hit quantity, with every section starting on a 64 byte boundary so that the columns
+// can be used in place once the file is memory-mapped. Everything is written in the native byte order.
+
+struct SkimEventRecord {
+    std::int64_t entry;
+    std::uint32_t firstMuon; // Index into the cluster's muon table
+    std::uint32_t nMuons;
+    std::uint32_t firstHit; // Index into the cluster's hit columns
+    std::uint32_t nHits;
+};
+
+// Streams events into a skim file, holding at most one cluster in memory
+class SkimWriter {
+  public:
+    explicit SkimWriter(std::size_t hitsPerCluster = 1 << 20);
+    ~SkimWriter();
+
+    // The geometry key is the source key of the geometry sidecar written with the skim, 0 if there is none
+    bool open(const std::string &path, std::uint64_t geometryKey);
+    void addEvent(const EventView &event);
+    // Writes the last cluster and the final event count, returns false if any write failed
+    bool close();
+
+  private:
+    void flushCluster();
+
+    std::size_t hitsPerCluster;
+    std::ofstream file;
+    std::uint64_t geometryKey = 0;
+    std::uint64_t nEvents = 0;
+    std::uint64_t nClusters = 0;
+    std::vector<SkimEventRecord> events;
+    std::vector<MuonKinematics> muons;
+    std::vector<std::int32_t> tubeId;
+    std::vector<double> time;
+    std::vector<float> charge;
+};
+
+// Memory-maps a skim file and hands out zero-copy views of its events. The reader is read-only once open, so a
+// single reader can be shared by any number of threads.
+class SkimReader {
+  public:
+    SkimReader() = default;
+    SkimReader(const SkimReader &) = delete;
+    SkimReader &operator=(const SkimReader &) = delete;
+    ~SkimReader();
+
+    bool open(const std::string &path);
+    void close();
+
+    std::size_t size() const { return nEvents; }
+    EventView event(std::size_t index) const;
+    // The source key of the geometry the skim was made with, 0 if the skim does not record it
+    std::uint64_t geometryKey() const { return sourceGeometryKey; }
+
+  private:
+    struct Cluster {
+        std::size_t firstEvent;
+        const SkimEventRecord *events;
+        const MuonKinematics *muons;
+        const std::int32_t *tubeId;
+        const double *time;
+        const float *charge;
+    };
+
+    const char *data = nullptr;
+    std::size_t length = 0;
+    std::size_t nEvents = 0;
+    std::uint64_t sourceGeometryKey = 0;
+    std::vector<Cluster> clusters;
+};
+
+// Returns true if the file starts with the skim file magic
+bool isSkimFile(const std::string &path);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Expands the input arguments of a program into a list of files, in the order given. An argument that starts with
+// @ names a text file that lists one input per line, blank lines and lines starting with # are skipped. An
+// argument, or a line of a list, that contains a wildcard is expanded with glob(3) in sorted order. Anything else
+// is taken as a file name. Returns false if a list cannot be read or a pattern matches nothing.
+bool expandInputs(const std::vector<std::string> &arguments, std::vector<std::string> &files);
+
+// One of count equal parts of a job, written index/count on the command line with 0 <= index < count
+struct ShardSpec {
+    std::int64_t index = 0;
+    std::int64_t count = 1;
+};
+
+bool parseShard(const std::string &spec, ShardSpec &shard);
+// Narrows [first, last) to the part of it that belongs to the shard. The shards of a range are contiguous, nearly
+// equal in size and together cover it exactly once. Takes long long to match ROOT's Long64_t entry numbers.
+void shardRange(const ShardSpec &shard, long long &first, long long &last);
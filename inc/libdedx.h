@@ -0,0 +1,26 @@
+#pragma once
+
+// The public API of libdedx, the ROOT-free core of the dE/dx reconstruction. Link with -ldedx, both the static
+// and the shared library are built by `make lib`.
+//
+// A minimal use, with one reconstructor per thread:
+//     PMTGeometry geometry;
+//     readPMTGeometry(geometry, "detector.pmtgeo");
+//     DedxReconstructor reconstructor(geometry);
+//     std::vector<DedxRecord> records;
+//     reconstructor.reconstruct(events, nEvents, records);
+// where the events are EventViews of flat hit columns, either filled by the caller, taken from a FlatEvent or
+// read from a skim file with SkimReader.
+
+#include "cherenkov_solver.h"
+#include "dedx_estimator.h"
+#include "dedx_reconstructor.h"
+#include "emission_formulas.h"
+#include "event_pipeline.h"
+#include "flat_event.h"
+#include "hit_skim.h"
+#include "logger.h"
+#include "physics_constants.h"
+#include "pmt_geometry.h"
+#include "solve_cache.h"
+#include "track_census.h"
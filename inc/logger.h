@@ -0,0 +1,63 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+
+// Leveled logging with per-thread buffered sinks.
+//
+// Messages are written with the LOG_* macros, which take a stream expression:
+//     LOG_DEBUG("Processing entry " << entry);
+// Levels above DEDX_LOG_MAX_LEVEL are removed by the preprocessor, so their arguments are never evaluated. Levels
+// that are compiled in cost one comparison when they are switched off at runtime with setLogLevel.
+//
+// Debug and trace messages, the ones that can be written per event or per hit, are collected in a buffer owned by
+// the calling thread and written to standard output in blocks when the buffer fills, when flushLog is called or
+// when the thread exits. Info messages go to standard output and warnings and errors to standard error straight
+// away, after the thread's earlier messages.
+
+enum class LogLevel { Error = 0, Warning = 1, Info = 2, Debug = 3, Trace = 4 };
+
+// The most verbose level that is compiled in, pass -DDEDX_LOG_MAX_LEVEL=4 to the compiler to keep trace messages
+#ifndef DEDX_LOG_MAX_LEVEL
+#define DEDX_LOG_MAX_LEVEL 3
+#endif
+
+void setLogLevel(LogLevel level);
+LogLevel getLogLevel();
+bool logEnabled(LogLevel level);
+// Parses error, warning, info, debug or trace, returns false if the name is not one of them
+bool parseLogLevel(const std::string &name, LogLevel &level);
+
+void logMessage(LogLevel level, const std::string &message);
+// Writes out the calling thread's buffered messages
+void flushLog();
+
+#define DEDX_LOG(level, expression)                                                                                 \
+    do {                                                                                                            \
+        if (logEnabled(level)) {                                                                                    \
+            std::ostringstream logStream;                                                                           \
+            logStream << expression;                                                                                \
+            logMessage(level, logStream.str());                                                                     \
+        }                                                                                                           \
+    } while (0)
+
+#define LOG_ERROR(expression) DEDX_LOG(LogLevel::Error, expression)
+#define LOG_WARNING(expression) DEDX_LOG(LogLevel::Warning, expression)
+
+#if DEDX_LOG_MAX_LEVEL >= 2
+#define LOG_INFO(expression) DEDX_LOG(LogLevel::Info, expression)
+#else
+#define LOG_INFO(expression) ((void)0)
+#endif
+
+#if DEDX_LOG_MAX_LEVEL >= 3
+#define LOG_DEBUG(expression) DEDX_LOG(LogLevel::Debug, expression)
+#else
+#define LOG_DEBUG(expression) ((void)0)
+#endif
+
+#if DEDX_LOG_MAX_LEVEL >= 4
+#define LOG_TRACE(expression) DEDX_LOG(LogLevel::Trace, expression)
+#else
+#define LOG_TRACE(expression) ((void)0)
+#endif
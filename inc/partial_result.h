@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TH1.h"
+#include "TH2D.h"
+
+#include "cherenkov_solver.h"
+#include "dedx_estimator.h"
+#include "fixed_histogram.h"
+#include "hit_preselection.h"
+
+// The histograms as the workers fill them in the hit loop, one set per worker. Their binning is also the binning
+// of the ROOT histograms of the partial result, which they are added into once the workers have finished.
+struct HitHistograms {
+    FixedHistogram1D<3500> hitTime{0, 70000};            // ns
+    FixedHistogram2D<70, 35> hitTimeVsZ{0, 35, 0, 2000}; // 10 m along the track against ns
+
+    void merge(const HitHistograms &other) {
+        hitTime.merge(other.hitTime);
+        hitTimeVsZ.merge(other.hitTimeVsZ);
+    }
+};
+
+// Everything that a dedx job measures apart from the dE/dx records themselves: the histograms, the accumulators
+// and enough about the job to tell what it covered. It is written to a small ROOT file, the partial result, that
+// the merge program reads back. Merging is associative, so the partial results of a production split over many
+// jobs can be reduced in any order and in any tree shape.
+struct PartialResult {
+    static constexpr int formatVersion = 2;
+
+    // Configuration, partial results only merge when it agrees
+    DedxEstimatorConfig estimatorConfig;
+    PreselectionConfig preselectionConfig;
+    double ng = ::ng;
+    double cVac = ::cVac;
+
+    // What was processed, each input is written as "<file> [first, last)"
+    std::vector<std::string> inputs;
+    std::int64_t nEntries = 0;
+    // Name of the dE/dx record file written alongside, relative to the directory of the partial result
+    std::string recordsFile;
+
+    std::unique_ptr<TH1D> hitTimeHist;
+    std::unique_ptr<TH2D> hitTimeVsZ;
+    RunningStats dedxStats; // Truncated mean dE/dx of every track
+    bool hasDiscriminants = false;
+    DiscriminantCounters discriminantCounters;
+
+    void bookHistograms();
+    // Adds the fixed-bin histograms of a worker into the booked histograms
+    void add(const HitHistograms &histograms);
+    // Returns false, with the reason, if the two results were made with different configurations
+    bool compatible(const PartialResult &other, std::string &reason) const;
+    // Adds the other result into this one, the histograms must have been booked. The histogram statistics are
+    // recomputed from the bins, so the result does not depend on how the work was split.
+    void merge(const PartialResult &other);
+};
+
+bool writePartialResult(const PartialResult &result, const std::string &path);
+bool readPartialResult(PartialResult &result, const std::string &path);
+// Draws the histograms into <outputBase>_hitTimeHist.C and <outputBase>_hitTimeVsZ.C
+void drawPartialResult(const PartialResult &result, const std::string &outputBase);
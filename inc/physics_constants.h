@@ -0,0 +1,5 @@
+#pragma once
+
+constexpr double cVac = 29.9792458; // cm/ns
+constexpr double ng = 1.38;         // Group refractive index in water for Cherenkov light
+constexpr double pi = 3.14159265358979323846;
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "aligned_allocator.h"
+
+template <class T> using AlignedVector = std::vector<T, CacheAlignedAllocator<T>>;
+
+// Flat copy of the PMT positions, orientations and cylinder locations of a detector, stored as one contiguous,
+// cache aligned column per quantity. Row i holds the PMT with tube ID i + 1, the same convention as
+// WCSimRootGeom::GetPMT(tubeNumber - 1).
+struct PMTGeometry {
+    AlignedVector<double> x, y, z;          // cm
+    AlignedVector<double> dirX, dirY, dirZ; // unit vector the PMT faces
+    AlignedVector<std::int32_t> cylLoc;     // 0 top cap, 1 barrel, 2 bottom cap
+
+    std::size_t size() const { return x.size(); }
+    void resize(std::size_t nPMTs);
+    bool contains(int tubeId) const { return tubeId >= 1 && std::size_t(tubeId) <= size(); }
+    static std::size_t index(int tubeId) { return std::size_t(tubeId - 1); }
+};
+
+// Writes the table to a small binary sidecar file so that later runs on the same detector configuration do not
+// need to load WCSimRootGeom at all. The source key identifies the geometry the table was built from, so that a
+// sidecar left over from another detector configuration is not taken for this one. The file is written in the
+// native byte order of the machine.
+bool writePMTGeometry(const PMTGeometry &geometry, const std::string &path, std::uint64_t sourceKey);
+// Reads a sidecar written by writePMTGeometry. Returns false if the file is missing, is not a complete geometry
+// table or was built from another source than sourceKey, and logs why unless the file is missing. A source key of
+// 0 stands for an unknown source and matches any sidecar.
+bool readPMTGeometry(PMTGeometry &geometry, const std::string &path, std::uint64_t sourceKey);
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "dedx_reconstructor.h"
+#include "flat_event.h"
+#include "hit_preselection.h"
+#include "pmt_geometry.h"
+
+// Persistent cache of the solved emission points of an input, so that a rerun that only changes what is done with
+// the solutions - the dE/dx binning and truncation, the histograms or the selection - streams them back instead of
+// reading and solving the input again.
+//
+// The cache is a directory of pieces, each holding the solutions of a range [begin, end) of the entries of one
+// input, in entry order. A piece is named <key>_<begin>_<end>.solve, where the key is a hash of the input's
+// content and of everything the solutions depend on: the PMT geometry, the preselection, the muon selection and the
+// solver constants.
+// Changing any of them gives new keys, so stale pieces are never used, they are just left behind. A range is taken
+// from the cache when pieces of its key cover it, whatever ranges they were written for, so a rerun on a different
+// number of threads or with new inputs added only processes what has not been seen before.
+//
+// A piece keeps, for every event, its entry, its number of hits, what the preselection counted, its muons and the
+// time, charge and solutions of the gathered hits, with the preselection windows of each muon. The PMT positions
+// are not kept, they are fixed by the geometry of the key. Everything is written in the native byte order.
+
+struct SolveCachePiece {
+    std::string path;
+    std::int64_t begin;
+    std::int64_t end;
+};
+
+class SolveCache {
+  public:
+    // Opens the cache in the directory, creating it if needed, for solutions made with the geometry and
+    // preselection, and with or without the mu+ of each event. Returns false if the directory cannot be created.
+    bool open(const std::string &directory, const PMTGeometry &geometry, const PreselectionConfig &preselection,
+              bool antiMuons);
+
+    // The key of an input file. The file is identified by its size, its inode and modification time, and a hash of
+    // its first and last MiB, which for a ROOT file includes its UUID, so it does not need to be read in full. A file
+    // that is rewritten, even to the same size, gets a new key, and so does a copy of it, whose solutions are then
+    // made again. Returns an empty key if the file cannot be read.
+    std::string key(const std::string &inputPath) const;
+    // Finds pieces that together cover the entries [begin, end) of the input with the key, in entry order. Returns
+    // false if some of the entries are not in the cache.
+    bool find(const std::string &key, std::int64_t begin, std::int64_t end,
+              std::vector<SolveCachePiece> &pieces) const;
+    // Where the piece for the entries [begin, end) of the input with the key is written
+    std::string piecePath(const std::string &key, std::int64_t begin, std::int64_t end) const;
+
+  private:
+    std::string directory;
+    std::uint64_t configHash = 0;
+};
+
+// Writes the events of a piece one at a time. The piece is written under a temporary name and only renamed into
+// place by close(), so an interrupted job never leaves a partial piece behind.
+class SolveCacheWriter {
+  public:
+    SolveCacheWriter() = default;
+    SolveCacheWriter(const SolveCacheWriter &) = delete;
+    SolveCacheWriter &operator=(const SolveCacheWriter &) = delete;
+    ~SolveCacheWriter();
+
+    bool open(const std::string &path);
+    // Adds an event with the hits as they were gathered and solved against its muons, or against a single track
+    // when it has none, and the counts of the preselection while they were gathered
+    void addEvent(const EventView &event, const SolvedHits &hits, const PreselectionCounters &preselection);
+    // Finishes the piece, returns false, leaving no piece, if any write failed
+    bool close();
+    // Drops the piece
+    void discard();
+
+  private:
+    std::string path;
+    std::string temporaryPath;
+    std::ofstream file;
+    std::uint64_t nEvents = 0;
+};
+
+// An event read back from a piece, the hits go into a SolvedHits
+struct CachedEvent {
+    std::int64_t entry = -1;
+    std::uint64_t nHits = 0; // Hits in the event, before any were left out when gathering
+    PreselectionCounters preselection;
+    std::vector<MuonKinematics> muons;
+};
+
+// Reads the events of a piece back in order
+class SolveCacheReader {
+  public:
+    bool open(const std::string &path);
+    std::uint64_t size() const { return nEvents; }
+    // Reads the next event, the hits keep the capacity of their columns. Returns false at the end of the piece or if
+    // it cannot be read.
+    bool next(CachedEvent &event, SolvedHits &hits);
+    // Steps over the next event without reading it
+    bool skip();
+
+  private:
+    std::ifstream file;
+    std::uint64_t nEvents = 0;
+    std::uint64_t nRead = 0;
+};
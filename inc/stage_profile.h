@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Low overhead instrumentation of where a job spends its time. Each thread owns a StageProfile and times the
+// stages of its work into it with StageTimer, which reads the CPU's time stamp counter where there is one, so a
+// timer costs a few tens of cycles. Profiling is switched on at runtime by handing the timers a profile; with a
+// null profile a timer does nothing but one comparison. The profiles of the threads are reported side by side and
+// summed at the end.
+
+enum class Stage {
+    FileOpen,     // Opening an input and setting up its reading
+    GeometryLoad, // Reading or building the PMT geometry
+    ReadEntry,    // TTree::GetEntry, reading, decompressing and unpacking an event
+    Decode,       // Scanning the tracks and hits of an event into flat columns
+    Gather,       // Looking up the PMT of every hit and preselecting the hits
+    Solve,        // Solving the emission points
+    Fill,         // Filling the histograms
+    Measure,      // Binning the charge along the tracks and writing the records
+    Output,       // Writing the results
+};
+constexpr std::size_t nStages = std::size_t(Stage::Output) + 1;
+
+const char *stageName(Stage stage);
+
+// Reads the time stamp counter, or a monotonic clock in ns where there is none
+std::uint64_t readTicks();
+// The rate of readTicks, measured against the system clock the first time it is called
+double ticksPerSecond();
+
+struct StageProfile {
+    std::array<std::uint64_t, nStages> ticks = {};
+    std::array<std::uint64_t, nStages> calls = {};
+    std::uint64_t events = 0;
+    std::uint64_t hits = 0;         // Hits of the events
+    std::uint64_t rejectedHits = 0; // Hits dropped by the preselection
+    std::uint64_t solvedHits = 0;   // Hits solved, once per track
+    std::uint64_t validRoots = 0;   // Solved hits with at least one real root
+
+    void add(Stage stage, std::uint64_t elapsed) {
+        ticks[std::size_t(stage)] += elapsed;
+        calls[std::size_t(stage)]++;
+    }
+    void merge(const StageProfile &other);
+};
+
+// Times the enclosing scope into a stage of the profile, if there is one
+class StageTimer {
+  public:
+    StageTimer(StageProfile *profile, Stage stage) : profile(profile), stage(stage) {
+        if (profile) {
+            start = readTicks();
+        }
+    }
+    ~StageTimer() { stop(); }
+    // Ends the timing before the end of the scope
+    void stop() {
+        if (profile) {
+            profile->add(stage, readTicks() - start);
+            profile = nullptr;
+        }
+    }
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+  private:
+    StageProfile *profile;
+    Stage stage;
+    std::uint64_t start = 0;
+};
+
+// Writes the report of a run: the rates over the wall time of the run and the time, calls and share of each stage,
+// for the sum of the threads and then for each thread. threadNames label the profiles, for example "main" and
+// "worker 0", and must be as many as them.
+void writeProfileText(std::ostream &stream, const std::vector<StageProfile> &profiles,
+                      const std::vector<std::string> &threadNames, double wallSeconds);
+void writeProfileJSON(std::ostream &stream, const std::vector<StageProfile> &profiles,
+                      const std::vector<std::string> &threadNames, double wallSeconds);
+// Writes the report to a file, as JSON if its name ends in .json and as text otherwise
+bool writeProfileReport(const std::string &path, const std::vector<StageProfile> &profiles,
+                        const std::vector<std::string> &threadNames, double wallSeconds);
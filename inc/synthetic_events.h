@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "flat_event.h"
+#include "pmt_geometry.h"
+
+// Generator of WCSim-like events that needs neither WCSim nor an input file, used by the benchmarks. Muons are
+// straight tracks that enter through the top cap of a cylindrical detector and travel at the speed of light. Each
+// PMT near the Cherenkov cone is hit by light emitted at an angle a little away from the Cherenkov angle, as the
+// spread of the angle from the muon's scattering and the dispersion of the water would give, at the analytically
+// correct time for that emission point. Light at exactly the Cherenkov angle arrives at the earliest possible time,
+// where the two roots of the solver meet, so away from it the roots are clearly apart and one of them is the
+// emission point.
+
+struct SyntheticDetectorConfig {
+    double radius = 3240;     // cm, roughly Hyper-K sized
+    double halfHeight = 3290; // cm
+    double pmtSpacing = 70.7; // cm, gives about 40k PMTs for the default size
+};
+
+struct SyntheticEventConfig {
+    double detectionProbability = 0.1; // Probability that a PMT on the Cherenkov cone records a hit
+    double noiseHitsPerEvent = 0;      // Mean number of dark noise hits, uniform in time and over the PMTs
+    double noiseWindow = 1000;         // ns, window after the muon enters in which noise hits fall
+    double maxZenith = 0.6;            // rad, the muon direction is drawn up to this angle from straight down
+    // rad, the light is emitted between a fifth of this and this far either side of the Cherenkov angle
+    double angleSpread = 0.05;
+    int muonsPerEvent = 1;             // Muons of the event, independent tracks that all enter at time 0
+};
+
+// What the generator knows about the hits of an event, for checking the reconstruction against
+struct SyntheticTruth {
+    // Per hit of the event, in the same order: the muon and the distance along its track at which the light was
+    // emitted, -1 and NaN for the noise hits
+    std::vector<int> muon;
+    std::vector<double> emission;
+};
+
+// Places PMTs on a regular grid over the barrel and the two caps, all facing into the detector
+PMTGeometry makeSyntheticGeometry(const SyntheticDetectorConfig &config);
+
+class SyntheticEventGenerator {
+  public:
+    SyntheticEventGenerator(const PMTGeometry &geometry, const SyntheticDetectorConfig &detector,
+                            const SyntheticEventConfig &config, std::uint64_t seed);
+
+    // Fills the event with its muons and their hits, and the truth with where each hit came from if it is given.
+    // The hits of each muon are given in tube ID order, one muon after the other, with any noise hits appended
+    // after them.
+    void generate(std::int64_t entry, FlatEvent &event, SyntheticTruth *truth = nullptr);
+
+  private:
+    const PMTGeometry &geometry;
+    SyntheticDetectorConfig detector;
+    SyntheticEventConfig config;
+    std::mt19937_64 random;
+};
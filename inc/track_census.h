@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "flat_hash_map.h"
+
+// A cut on the true tracks of an event, a track passes if its PDG code matches and its energy is in
+// [minEnergy, maxEnergy), or if it fails that when the selection is inverted
+struct TrackSelection {
+    std::string name;
+    bool anyParticle = true;
+    int pdg = 0;
+    double minEnergy = -std::numeric_limits<double>::infinity(); // MeV
+    double maxEnergy = std::numeric_limits<double>::infinity();  // MeV
+    bool inverted = false;
+
+    bool accepts(int trackPdg, double energy) const {
+        bool pass = (anyParticle || trackPdg == pdg) & (energy >= minEnergy) & (energy < maxEnergy);
+        return pass != inverted;
+    }
+};
+
+// Parses name:pdg:min:max[:not], where an empty or * field places no cut and the name can only hold letters,
+// digits, - and _ as it is used in the output file names. Returns false if the specification is not valid.
+bool parseTrackSelection(const std::string &spec, TrackSelection &selection);
+
+// Counts the tracks that pass each of a list of selections by particle type and by the process that created them,
+// so that every cut is evaluated in one read of the file. Each worker fills its own census and the censuses are
+// merged at the end.
+//
+// The creator process is counted by the simulation's integer process code. Its name is only looked up the first
+// time a census sees a code, and interned, so that no string is built or compared per track.
+class TrackCensus {
+  public:
+    explicit TrackCensus(const std::vector<TrackSelection> &selections);
+
+    bool knowsProcess(int processCode) const { return processIds.find(processCode) != nullptr; }
+    void nameProcess(int processCode, const std::string &name);
+    // The process code must have been named first
+    void add(int pdg, double energy, int processCode);
+
+    // Adds the counts of another census with the same selections, matching the processes by name
+    void merge(const TrackCensus &other);
+
+    const std::vector<TrackSelection> &selections() const { return cuts; }
+    std::uint64_t nTracks() const { return tracks; }
+    std::uint64_t nPassed(std::size_t selection) const { return passed[selection]; }
+    // Counts of the tracks that passed a selection, sorted by PDG code and by process name
+    std::vector<std::pair<int, std::uint64_t>> particleCounts(std::size_t selection) const;
+    std::vector<std::pair<std::string, std::uint64_t>> processCounts(std::size_t selection) const;
+
+  private:
+    std::uint32_t internProcess(const std::string &name);
+
+    std::vector<TrackSelection> cuts;
+    std::uint64_t tracks = 0;
+    std::vector<std::uint64_t> passed;
+    std::vector<FlatHashMap<int, std::uint64_t>> byParticle;
+    std::vector<FlatHashMap<std::uint32_t, std::uint64_t>> byProcess; // Keyed by interned process ID
+    FlatHashMap<int, std::uint32_t> processIds;                       // Process code to interned ID
+    std::vector<std::string> processNames;                            // Interned ID to name
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+#include "flat_event.h"
+
+class TFile;
+class TTree;
+class WCSimRootEvent;
+
+// Returns the WCSim event tree from an open file, or a null pointer if it cannot be found
+TTree *getWCSimTree(TFile *WCSimFile);
+// Decodes the muon tracks and the digitised hits of every trigger of an event into a FlatEvent. The muons are the
+// primary (flag 0, parent 0) mu- tracks, and the mu+ tracks as well if antiMuons is set, in the order WCSim lists
+// them. The hit times of the later triggers are shifted by the difference of their trigger time from the first
+// trigger's, so that all of the hits are on one clock.
+void readFlatEvent(WCSimRootEvent *wcSimRootSuperEvent, std::int64_t entry, FlatEvent &event,
+                   bool antiMuons = false);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "pmt_geometry.h"
+
+class TFile;
+class WCSimRootGeom;
+
+// Copies every PMT of a WCSimRootGeom into the flat geometry table
+bool buildPMTGeometry(WCSimRootGeom *geo, PMTGeometry &geometry);
+// Reads the geometry tree, wcsimGeoT, of an open WCSim file into the flat geometry table
+bool loadPMTGeometry(TFile *WCSimFile, PMTGeometry &geometry);
+// The source key of the geometry of an open WCSim file, for the geometry sidecar. It is a hash of the number of
+// entries and of the uncompressed and compressed sizes of the geometry tree, which are kept in the tree's header,
+// so the geometry does not have to be read. Returns 0 if the file has no geometry tree.
+std::uint64_t geometrySourceKey(TFile *WCSimFile);
+// Loads the geometry table from the sidecar file if it exists and was built from the geometry of the WCSim file.
+// Otherwise the table is built from the geometry tree of the WCSim file and, if a sidecar path was given, written
+// there for the next run.
+bool loadPMTGeometry(TFile *WCSimFile, const std::string &sidecarPath, PMTGeometry &geometry);
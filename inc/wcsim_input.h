@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class TBranch;
+class TFile;
+class TTree;
+class WCSimRootEvent;
+
+struct WCSimInputConfig {
+    // Size of the TTreeCache in MB, 0 turns it off. The cache reads the baskets of every active branch for a
+    // range of entries in a few large requests instead of one small request per basket.
+    double cacheSizeMB = 64;
+};
+
+// How much a worker read and how long it took. The time is spent in TTree::GetEntry, which covers waiting for the
+// storage, decompressing the baskets and unpacking the objects; ROOT does not time these separately outside of
+// its own multi-threaded unzipping.
+struct WCSimInputStats {
+    std::int64_t entries = 0;
+    std::int64_t fileBytes = 0;     // Compressed bytes read from the files
+    std::int64_t readCalls = 0;     // Read requests made to the storage
+    std::int64_t unpackedBytes = 0; // Uncompressed bytes unpacked into the events
+    double readSeconds = 0;
+
+    void merge(const WCSimInputStats &other);
+    // A one line summary, with the bytes and time per event
+    std::string summary() const;
+};
+
+// Turns ROOT's asynchronous read-ahead of the next block of the cache on or off for every file opened afterwards.
+// It is a global ROOT setting, so it must be called before the worker threads are started.
+void setWCSimPrefetch(bool enabled);
+// Sets ROOT up to be used from several threads, each reading with its own WCSimInput, and sets the read-ahead.
+// Must be called before the worker threads are started.
+void setUpWCSimThreads(bool prefetch);
+
+// Reads the events of one WCSim file for one worker. Only the wcsimrootevent branch is read, with all of its
+// sub-branches, through TBranch::GetEntry, so the other event branches, such as the outer detector's, are never
+// read, and the cache is trained on the worker's range of entries up front rather than during the first entries.
+// Each WCSimInput opens its own TFile, so that the TTree and the WCSimRootEvent it is read into are never shared
+// between threads; a program that reads from several threads gives every thread its own.
+class WCSimInput {
+  public:
+    WCSimInput() = default;
+    ~WCSimInput();
+    WCSimInput(const WCSimInput &) = delete;
+    WCSimInput &operator=(const WCSimInput &) = delete;
+
+    // Opens the file and sets up the reading of the entries [firstEntry, lastEntry), a negative lastEntry means
+    // up to the end of the file. Logs and returns false on failure.
+    bool open(const std::string &path, const WCSimInputConfig &config, std::int64_t firstEntry = 0,
+              std::int64_t lastEntry = -1);
+    // Reads an entry into event(), returns false if it could not be read
+    bool read(std::int64_t entry);
+    void close();
+
+    TFile *file() const { return input.get(); }
+    std::int64_t entries() const { return nEntries; }
+    WCSimRootEvent *event() const { return superEvent; }
+    const WCSimInputStats &stats() const { return counters; }
+
+  private:
+    std::unique_ptr<TFile> input;
+    TTree *tree = nullptr;
+    TBranch *eventBranch = nullptr;
+    WCSimRootEvent *superEvent = nullptr;
+    std::int64_t nEntries = 0;
+    std::int64_t openBytes = 0;
+    std::int64_t openCalls = 0;
+    WCSimInputStats counters;
+};
@@ -0,0 +1,503 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fixed_histogram.h"
+#include "libdedx.h"
+#include "synthetic_events.h"
+
+// Micro and macro benchmarks of the dE/dx reconstruction on synthetic events, so that they run on any machine
+// without WCSim or an input file. Build with `make bench` and run bin/bench.
+
+namespace {
+
+// Runs the function until at least minSeconds have passed and returns the mean time of one call in seconds
+double timeIt(const std::function<void()> &function, double minSeconds) {
+    using Clock = std::chrono::steady_clock;
+    function(); // Warm up
+    std::size_t calls = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0;
+    do {
+        function();
+        calls++;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < minSeconds);
+    return elapsed / calls;
+}
+
+void solveHits(const MuonTrack &track, SolvedHits &hits, SolverPath path) {
+    std::size_t n = hits.size();
+    hits.rootPlus.resize(n);
+    hits.rootMinus.resize(n);
+    hits.nRoots.resize(n);
+    HitBatch batch = {hits.x.data(), hits.y.data(), hits.z.data(), hits.t.data(), n};
+    SolverOutput output = {hits.rootPlus.data(), hits.rootMinus.data(), hits.nRoots.data(), nullptr};
+    solveEmissionPoints(track, batch, output, path);
+}
+
+// The per event work of dedx without the ROOT histograms: gather, solve and estimate dE/dx
+double processEvents(const std::vector<FlatEvent> &events, std::size_t begin, std::size_t end,
+                     const PMTGeometry &geometry, SolverPath path, bool preselect) {
+    DedxReconstructorConfig config;
+    config.solverPath = path;
+    config.preselection.enabled = preselect;
+    DedxReconstructor reconstructor(geometry, config);
+    double checksum = 0;
+    for (std::size_t i = begin; i < end; i++) {
+        checksum += reconstructor.reconstruct(events[i].view(), 0).totalCharge;
+    }
+    return checksum;
+}
+
+bool sameRecord(const DedxRecord &a, const DedxRecord &b) {
+    return a.entry == b.entry && a.muonIndex == b.muonIndex && a.nHits == b.nHits && a.nBins == b.nBins &&
+           a.totalCharge == b.totalCharge && a.truncatedMeanDqdx == b.truncatedMeanDqdx;
+}
+
+bool sameStats(const RunningStats &a, const RunningStats &b) {
+    return a.count == b.count && a.mean == b.mean && a.m2 == b.m2 && a.min == b.min && a.max == b.max;
+}
+
+// The dE/dx statistics of a run as dedx accumulates them, from the records in entry order
+RunningStats recordStats(const std::vector<DedxRecord> &records) {
+    RunningStats stats;
+    for (const DedxRecord &record : records) {
+        addTruncatedMean(stats, record.truncatedMeanDqdx);
+    }
+    return stats;
+}
+
+// The event pipeline of dedx --pipeline: a reader thread copies the events into the slots, as it would decode them,
+// taking at least readSeconds per event, the solvers reconstruct them and the calling thread takes the records in
+// order
+void runPipeline(const std::vector<FlatEvent> &events, const PMTGeometry &geometry, unsigned int nSolvers,
+                 double readSeconds, std::vector<DedxRecord> &records) {
+    records.clear();
+    EventPipeline pipeline(8 * nSolvers, nSolvers);
+    std::vector<std::thread> threads;
+    threads.emplace_back([&]() {
+        for (const FlatEvent &event : events) {
+            if (readSeconds > 0) {
+                std::this_thread::sleep_for(std::chrono::duration<double>(readSeconds));
+            }
+            PipelineSlot *slot = pipeline.acquire();
+            slot->event.entry = event.entry;
+            slot->event.muons.assign(event.muons.begin(), event.muons.end());
+            slot->event.tubeId.assign(event.tubeId.begin(), event.tubeId.end());
+            slot->event.time.assign(event.time.begin(), event.time.end());
+            slot->event.charge.assign(event.charge.begin(), event.charge.end());
+            pipeline.submit(slot);
+        }
+        pipeline.finishReading();
+    });
+    for (unsigned int solver = 0; solver < nSolvers; solver++) {
+        threads.emplace_back([&]() {
+            DedxReconstructor reconstructor(geometry);
+            while (PipelineSlot *slot = pipeline.take()) {
+                reconstructor.reconstruct(slot->event.view(), slot->records);
+                pipeline.complete(slot);
+            }
+            pipeline.finishSolving();
+        });
+    }
+    while (PipelineSlot *slot = pipeline.next()) {
+        records.insert(records.end(), slot->records.begin(), slot->records.end());
+        pipeline.release(slot);
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+void printRate(const std::string &name, double seconds, double items, const char *unit) {
+    double rate = items / seconds;
+    bool mega = rate >= 1e6;
+    std::cout << "  " << std::left << std::setw(36) << name << std::right << std::setw(12) << std::fixed
+              << std::setprecision(2) << rate / (mega ? 1e6 : 1e3) << (mega ? " M" : " k") << unit << "/s"
+              << std::setw(12) << seconds * 1e3 << " ms" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int nEvents = 200;
+    unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    double noiseHits = 200; // About a 4 kHz dark rate over 40k PMTs in a 1 us window
+    double minSeconds = 0.2;
+    int muonsPerEvent = 4;
+    std::uint64_t seed = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--events" && i + 1 < argc) {
+            nEvents = std::atoi(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            maxThreads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--noise" && i + 1 < argc) {
+            noiseHits = std::atof(argv[++i]);
+        } else if (arg == "--muons" && i + 1 < argc) {
+            muonsPerEvent = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            minSeconds = std::atof(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--events <n>] [--threads <n>] [--noise <hits per event>] [--muons <per event>]"
+                      << " [--min-time <s>] [--seed <n>]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    if (nEvents < 1) {
+        nEvents = 1;
+    }
+
+    // Synthetic detector and events
+    SyntheticDetectorConfig detector;
+    SyntheticEventConfig eventConfig;
+    eventConfig.noiseHitsPerEvent = noiseHits;
+    PMTGeometry geometry = makeSyntheticGeometry(detector);
+    SyntheticEventGenerator generator(geometry, detector, eventConfig, seed);
+    std::vector<FlatEvent> events(nEvents);
+    std::vector<SyntheticTruth> truths(nEvents);
+    std::size_t nHits = 0;
+    for (int i = 0; i < nEvents; i++) {
+        generator.generate(i, events[i], &truths[i]);
+        nHits += events[i].tubeId.size();
+    }
+    std::cout << "Synthetic detector with " << geometry.size() << " PMTs, " << nEvents << " events, "
+              << double(nHits) / nEvents << " hits per event" << std::endl;
+
+    // Gather every event once so that the solver benchmark sees only the solve
+    DedxReconstructor reconstructor(geometry);
+    std::vector<SolvedHits> gathered(nEvents);
+    for (int i = 0; i < nEvents; i++) {
+        gathered[i] = reconstructor.gather(events[i].view());
+    }
+
+    std::cout << "Geometry lookup" << std::endl;
+    double seconds = timeIt(
+        [&]() {
+            for (const FlatEvent &event : events) {
+                reconstructor.gather(event.view());
+            }
+        },
+        minSeconds);
+    printRate("tube ID to position", seconds, nHits, "hits");
+
+    std::cout << "Emission point solver" << std::endl;
+    const SolverPath paths[] = {SolverPath::Scalar, SolverPath::AVX2, SolverPath::AVX512};
+    std::vector<SolvedHits> reference = gathered;
+    for (int i = 0; i < nEvents; i++) {
+        solveHits(muonTrack(events[i].muons[0]), reference[i], SolverPath::Scalar);
+    }
+    for (SolverPath path : paths) {
+        if (!solverPathSupported(path)) {
+            std::cout << "  " << solverPathName(path) << " not supported by this CPU" << std::endl;
+            continue;
+        }
+        seconds = timeIt(
+            [&]() {
+                for (int i = 0; i < nEvents; i++) {
+                    solveHits(muonTrack(events[i].muons[0]), gathered[i], path);
+                }
+            },
+            minSeconds);
+        // Every path should agree with the scalar one exactly
+        std::size_t mismatches = 0;
+        for (int i = 0; i < nEvents; i++) {
+            for (std::size_t hit = 0; hit < gathered[i].t.size(); hit++) {
+                if (gathered[i].nRoots[hit] != reference[i].nRoots[hit] ||
+                    (gathered[i].nRoots[hit] && (gathered[i].rootPlus[hit] != reference[i].rootPlus[hit] ||
+                                                 gathered[i].rootMinus[hit] != reference[i].rootMinus[hit]))) {
+                    mismatches++;
+                }
+            }
+        }
+        printRate(std::string(solverPathName(path)) + " (" + std::to_string(mismatches) + " mismatches)", seconds,
+                  nHits, "hits");
+    }
+
+    // How well the solver recovers the true emission points. Every hit on a PMT of the geometry is gathered, in the
+    // order of the event, so the truth of the generator lines up with the gathered hits.
+    std::size_t nSignal = 0, nReal = 0;
+    const double tolerances[] = {1e-9, 1e-6, 1e-3};
+    std::size_t nWithin[3] = {0, 0, 0};
+    for (int i = 0; i < nEvents; i++) {
+        const SolvedHits &hits = reference[i];
+        for (std::size_t hit = 0; hit < hits.size(); hit++) {
+            // Only the hits of the muon, not the noise
+            if (truths[i].muon[hit] != 0) {
+                continue;
+            }
+            double s = truths[i].emission[hit];
+            nSignal++;
+            if (!reference[i].nRoots[hit]) {
+                continue;
+            }
+            nReal++;
+            double error = std::fmin(std::fabs(reference[i].rootPlus[hit] - s),
+                                     std::fabs(reference[i].rootMinus[hit] - s));
+            for (int t = 0; t < 3; t++) {
+                nWithin[t] += error < tolerances[t];
+            }
+        }
+    }
+    std::cout << "  " << nReal << " of " << nSignal << " signal hits have real roots, the nearest root is within";
+    for (int t = 0; t < 3; t++) {
+        std::cout << (t ? ", " : " ") << std::defaultfloat << tolerances[t] << " cm for " << nWithin[t];
+    }
+    std::cout << std::endl;
+
+    // The emission point and time formulas of emission_formulas.h, exact and fast, at the solved emission points
+    std::cout << "Emission formulas" << std::endl;
+    std::vector<double> longDist, toHit;
+    std::vector<const MuonKinematics *> hitMuon;
+    for (int i = 0; i < nEvents; i++) {
+        const SolvedHits &hits = reference[i];
+        for (std::size_t hit = 0; hit < hits.size(); hit++) {
+            if (hits.nRoots[hit]) {
+                const MuonKinematics &muon = events[i].muons[0];
+                longDist.push_back(hits.rootPlus[hit]);
+                toHit.insert(toHit.end(), {hits.x[hit] - muon.start[0], hits.y[hit] - muon.start[1],
+                                           hits.z[hit] - muon.start[2]});
+                hitMuon.push_back(&muon);
+            }
+        }
+    }
+    std::vector<double> exactZT, fastZT;
+    for (FormulaPath path : {FormulaPath::Exact, FormulaPath::Fast}) {
+        std::vector<double> &zt = path == FormulaPath::Exact ? exactZT : fastZT;
+        zt.resize(2 * longDist.size());
+        seconds = timeIt(
+            [&]() {
+                for (std::size_t hit = 0; hit < longDist.size(); hit++) {
+                    double dir[3] = {hitMuon[hit]->dir[0], hitMuon[hit]->dir[1], hitMuon[hit]->dir[2]};
+                    zt[2 * hit] = calculateZ(longDist[hit], &toHit[3 * hit], dir, path);
+                    zt[2 * hit + 1] = calculateT(longDist[hit], &toHit[3 * hit], dir, path);
+                }
+            },
+            minSeconds);
+        printRate(std::string("calculateZ and calculateT, ") + formulaPathName(path), seconds, longDist.size(),
+                  "hits");
+    }
+    // The largest difference of the fast path from the exact one in z and in t
+    double maxError[2] = {0, 0};
+    for (std::size_t i = 0; i < exactZT.size(); i++) {
+        if (std::isfinite(exactZT[i])) {
+            maxError[i % 2] = std::fmax(maxError[i % 2], std::fabs(fastZT[i] - exactZT[i]));
+        }
+    }
+    std::cout << "  fast path over " << longDist.size() << " hits, largest difference " << std::scientific
+              << std::setprecision(1) << maxError[0] << " cm in z and " << maxError[1] << " ns in t"
+              << std::defaultfloat << std::endl;
+
+    // Filling the histograms of dedx from the solutions, as its hit loop does
+    std::cout << "Histogram filling" << std::endl;
+    std::size_t nFills = 0;
+    FixedHistogram1D<3500> hitTime(0, 70000);
+    FixedHistogram2D<70, 35> hitTimeVsZ(0, 35, 0, 2000);
+    seconds = timeIt(
+        [&]() {
+            nFills = 0;
+            for (const SolvedHits &hits : reference) {
+                for (std::size_t hit = 0; hit < hits.size(); hit++) {
+                    if (hits.nRoots[hit]) {
+                        hitTime.fill(hits.rootPlus[hit]);
+                        hitTimeVsZ.fill(hits.rootPlus[hit] / 1000, hits.t[hit]);
+                        nFills++;
+                    }
+                }
+            }
+        },
+        minSeconds);
+    printRate("fixed-bin 1D and 2D", seconds, nFills, "hits");
+
+    // What the preselection keeps, every signal hit should survive it
+    std::cout << "Hit preselection" << std::endl;
+    DedxReconstructorConfig preselectingConfig;
+    preselectingConfig.preselection.enabled = true;
+    DedxReconstructor preselecting(geometry, preselectingConfig);
+    std::size_t nKeptSignal = 0, nKept = 0;
+    std::vector<double> signalTimes;
+    for (int i = 0; i < nEvents; i++) {
+        // The kept hits are told apart by their times, which the generator draws from a continuous distribution
+        signalTimes.clear();
+        for (std::size_t hit = 0; hit < events[i].time.size(); hit++) {
+            if (truths[i].muon[hit] == 0) {
+                signalTimes.push_back(events[i].time[hit]);
+            }
+        }
+        std::sort(signalTimes.begin(), signalTimes.end());
+        const SolvedHits &hits = preselecting.gather(events[i].view(), events[i].muons[0]);
+        for (std::size_t hit = 0; hit < hits.size(); hit++) {
+            nKeptSignal += std::binary_search(signalTimes.begin(), signalTimes.end(), hits.t[hit]);
+        }
+        nKept += hits.size();
+    }
+    const PreselectionCounters &counters = preselecting.preselectionCounters();
+    std::cout << "  kept " << nKept << " of " << counters.nHits << " hits, " << nKeptSignal << " of " << nSignal
+              << " signal and " << nKept - nKeptSignal << " of " << counters.nHits - nSignal << " noise, "
+              << counters.outsideEventWindow << " rejected by the event window and " << counters.outsideConeWindow
+              << " by the PMT windows" << std::endl;
+
+    std::cout << "End to end (gather, solve, dE/dx)" << std::endl;
+    for (SolverPath path : {SolverPath::Scalar, bestSolverPath()}) {
+        for (bool preselect : {true, false}) {
+            for (unsigned int nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+                seconds = timeIt(
+                    [&]() {
+                        std::vector<std::thread> workers;
+                        for (unsigned int worker = 0; worker < nThreads; worker++) {
+                            std::size_t begin = std::size_t(nEvents) * worker / nThreads;
+                            std::size_t end = std::size_t(nEvents) * (worker + 1) / nThreads;
+                            workers.emplace_back(processEvents, std::cref(events), begin, end,
+                                                 std::cref(geometry), path, preselect);
+                        }
+                        for (std::thread &worker : workers) {
+                            worker.join();
+                        }
+                    },
+                    minSeconds);
+                std::string name = std::string(solverPathName(path)) + (preselect ? "" : ", no preselection") +
+                                   ", " + std::to_string(nThreads) + " thread(s)";
+                printRate(name, seconds, nEvents, "events");
+                if (nThreads < maxThreads && nThreads * 2 > maxThreads) {
+                    nThreads = maxThreads / 2;
+                }
+            }
+        }
+        if (path == SolverPath::Scalar && bestSolverPath() == SolverPath::Scalar) {
+            break;
+        }
+    }
+
+    // The same work through the event pipeline of dedx --pipeline
+    std::cout << "Pipelined (reader, solvers, records in order)" << std::endl;
+    std::vector<DedxRecord> serialRecords;
+    DedxReconstructor serial(geometry);
+    for (const FlatEvent &event : events) {
+        serial.reconstruct(event.view(), serialRecords);
+    }
+    for (unsigned int nSolvers = 1; nSolvers <= maxThreads; nSolvers *= 2) {
+        std::vector<DedxRecord> pipelinedRecords;
+        seconds = timeIt([&]() { runPipeline(events, geometry, nSolvers, 0, pipelinedRecords); }, minSeconds);
+        std::size_t mismatches =
+            serialRecords.size() == pipelinedRecords.size() ? 0 : std::max(serialRecords.size(), std::size_t(1));
+        for (std::size_t i = 0; i < serialRecords.size() && i < pipelinedRecords.size(); i++) {
+            mismatches += !sameRecord(serialRecords[i], pipelinedRecords[i]);
+        }
+        printRate(std::to_string(nSolvers) + " solver(s) (" + std::to_string(mismatches) + " mismatches)", seconds,
+                  nEvents, "events");
+        if (nSolvers < maxThreads && nSolvers * 2 > maxThreads) {
+            nSolvers = maxThreads / 2;
+        }
+    }
+
+    // The run statistics of dedx must not depend on how its entries are split between threads. Each split of the
+    // events into contiguous blocks, as dedx gives its workers, is reconstructed with one reconstructor per block,
+    // and the statistics accumulated from the records in entry order are compared bit for bit with those of a single
+    // thread, alongside those of merging the statistics of the blocks, which only agree up to rounding.
+    std::cout << "Run statistics split between threads (bit for bit against 1 thread)" << std::endl;
+    RunningStats serialStats = recordStats(serialRecords);
+    for (unsigned int nBlocks : {2u, 3u, 4u, 8u}) {
+        std::vector<DedxRecord> blockRecords;
+        RunningStats mergedStats;
+        for (unsigned int block = 0; block < nBlocks; block++) {
+            DedxReconstructor reconstructor(geometry);
+            for (std::size_t i = events.size() * block / nBlocks; i < events.size() * (block + 1) / nBlocks; i++) {
+                reconstructor.reconstruct(events[i].view(), blockRecords);
+            }
+            mergedStats.merge(reconstructor.runStats());
+        }
+        std::cout << "  " << nBlocks << " threads: in entry order "
+                  << (sameStats(recordStats(blockRecords), serialStats) ? "identical" : "DIFFERENT")
+                  << ", merged per thread " << (sameStats(mergedStats, serialStats) ? "identical" : "different")
+                  << std::endl;
+    }
+    std::vector<DedxRecord> pipelinedRecords;
+    runPipeline(events, geometry, std::max(maxThreads, 2u), 0, pipelinedRecords);
+    std::cout << "  pipelined: in entry order "
+              << (sameStats(recordStats(pipelinedRecords), serialStats) ? "identical" : "DIFFERENT") << std::endl;
+
+    // With a reader that takes twice as long per event as a solver, as when the input comes over the network, the
+    // solvers spend most of the run waiting for events, which should leave the cores to the rest of the machine.
+    // The CPU time of the process over the wall time shows how much of a core the waiting costs.
+    std::cout << "Pipelined with a slow reader (CPU time over wall time)" << std::endl;
+    std::vector<DedxRecord> solvedRecords;
+    double solveSeconds = timeIt(
+        [&]() {
+            solvedRecords.clear();
+            for (const FlatEvent &event : events) {
+                serial.reconstruct(event.view(), solvedRecords);
+            }
+        },
+        minSeconds);
+    for (unsigned int nSolvers = 1; nSolvers <= maxThreads; nSolvers *= 2) {
+        std::vector<DedxRecord> pipelinedRecords;
+        std::clock_t cpuStart = std::clock();
+        std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+        runPipeline(events, geometry, nSolvers, 2 * solveSeconds / nEvents, pipelinedRecords);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+        double cpuSeconds = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+        printRate(std::to_string(nSolvers) + " solver(s), " + std::to_string(std::lround(100 * cpuSeconds / seconds)) +
+                      "% CPU",
+                  seconds, nEvents, "events");
+        if (nSolvers < maxThreads && nSolvers * 2 > maxThreads) {
+            nSolvers = maxThreads / 2;
+        }
+    }
+
+    // Events with several muons, reconstructed one muon at a time and with all of the muons solved together
+    std::cout << "Events with " << muonsPerEvent << " muons" << std::endl;
+    eventConfig.muonsPerEvent = muonsPerEvent;
+    SyntheticEventGenerator multiGenerator(geometry, detector, eventConfig, seed);
+    std::vector<FlatEvent> multiEvents(nEvents);
+    for (int i = 0; i < nEvents; i++) {
+        multiGenerator.generate(i, multiEvents[i]);
+    }
+    for (bool preselect : {true, false}) {
+        DedxReconstructorConfig config;
+        config.preselection.enabled = preselect;
+        DedxReconstructor reconstructor(geometry, config);
+        std::vector<DedxRecord> separate, together;
+        double separateSeconds = timeIt(
+            [&]() {
+                separate.clear();
+                for (const FlatEvent &event : multiEvents) {
+                    for (std::size_t muon = 0; muon < event.muons.size(); muon++) {
+                        separate.push_back(reconstructor.reconstruct(event.view(), muon));
+                    }
+                }
+            },
+            minSeconds);
+        double togetherSeconds = timeIt(
+            [&]() {
+                together.clear();
+                for (const FlatEvent &event : multiEvents) {
+                    reconstructor.reconstruct(event.view(), together);
+                }
+            },
+            minSeconds);
+        std::size_t mismatches = separate.size() == together.size() ? 0 : separate.size();
+        for (std::size_t i = 0; i < separate.size() && i < together.size(); i++) {
+            mismatches += !sameRecord(separate[i], together[i]);
+        }
+        std::string suffix = preselect ? "" : ", no preselection";
+        printRate("one muon at a time" + suffix, separateSeconds, nEvents, "events");
+        printRate("all muons together" + suffix + " (" + std::to_string(mismatches) + " mismatches)",
+                  togetherSeconds, nEvents, "events");
+    }
+
+    return 0;
+}
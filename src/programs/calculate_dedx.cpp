@@ -1,4 +1,11 @@
+#include <cstdlib>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "TBranch.h"
 #include "TCanvas.h"
@@ -10,37 +17,225 @@
 
 #include "WCSimRootEvent.hh"
 
-int main(int argc, char **argv) {
-    // Check that we have a file in the arguments
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <input file>" << std::endl;
-        return 1;
+#include "fixed_histogram.h"
+#include "fixed_histogram_root.h"
+#include "logger.h"
+#include "track_census.h"
+#include "wcsim_input.h"
+
+// The census of one worker: the energy of every track and the tracks that passed each selection
+struct CensusWorker {
+    std::unique_ptr<TrackCensus> census;
+    FixedHistogram1D<300> energy{0.5, 0.8};
+    WCSimInputConfig inputConfig;
+    WCSimInputStats inputStats;
+    bool ok = false;
+};
+
+// Reads the entries [firstEntry, lastEntry) of the file into the worker's census
+void censusEntries(std::string WCSimFilePath, Long64_t firstEntry, Long64_t lastEntry, CensusWorker &worker) {
+    // Only the tracks are needed
+    WCSimInput input;
+    if (!input.open(WCSimFilePath, worker.inputConfig, firstEntry, lastEntry)) {
+        return;
     }
+    TrackCensus &census = *worker.census;
+
+    for (Long64_t event = firstEntry; event < lastEntry; event++) {
+        // Get the entry in the tree
+        if (!input.read(event)) {
+            return;
+        }
+        // Get the trigger
+        WCSimRootTrigger *wcsimrootevent = input.event()->GetTrigger(0);
+        if (!wcsimrootevent) {
+            LOG_WARNING("Entry " << event << " of " << WCSimFilePath << " has no trigger");
+            continue;
+        }
+        LOG_DEBUG("There are " << wcsimrootevent->GetNvtxs() << " vertices in this event");
 
-    // Open the file
-    TFile *wcsim_file = new TFile(argv[1], "READ");
+        int ntrack = wcsimrootevent->GetNtrack();
+        for (int j = 0; j < ntrack; j++) {
+            TObject *element = (wcsimrootevent->GetTracks()->At(j));
 
-    // Check that the file is open
-    if (!wcsim_file->IsOpen()) {
-        std::cerr << "Failed to open file: " << argv[1] << std::endl;
-        return 1;
+            WCSimRootTrack *wcsimroottrack = (WCSimRootTrack *)(element);
+
+            worker.energy.fill(wcsimroottrack->GetE());
+
+            // Every selection is evaluated on the track here, the process name is only built the first time the
+            // worker sees its process code
+            int process = int(wcsimroottrack->GetCreatorProcess());
+            if (!census.knowsProcess(process)) {
+                census.nameProcess(process, wcsimroottrack->GetCreatorProcessName());
+            }
+            census.add(wcsimroottrack->GetIpnu(), wcsimroottrack->GetE(), process);
+
+            if (DEDX_LOG_MAX_LEVEL >= 3 && wcsimroottrack->GetParenttype() == 0 && logEnabled(LogLevel::Debug)) {
+                std::ostringstream dump;
+                dump << " ======== TRACK " << j << " ========" << std::endl;
+                dump << "Parent type (PDG):  " << wcsimroottrack->GetParenttype() << std::endl;
+
+                dump << "Flag:               " << wcsimroottrack->GetFlag() << std::endl;
+
+                dump << "PDG:                " << wcsimroottrack->GetIpnu() << std::endl;
+
+                dump << "Mass:               " << wcsimroottrack->GetM() << std::endl;
+
+                dump << "Position start:    " << wcsimroottrack->GetStart(0) << " " << wcsimroottrack->GetStart(1)
+                     << " " << wcsimroottrack->GetStart(2) << std::endl;
+                dump << "Position end:      " << wcsimroottrack->GetStop(0) << " " << wcsimroottrack->GetStop(1)
+                     << " " << wcsimroottrack->GetStop(2) << std::endl;
+                dump << "Momentum:           " << wcsimroottrack->GetP() << std::endl;
+
+                dump << "Energy:             " << wcsimroottrack->GetE() << std::endl;
+
+                dump << "Direction:          " << wcsimroottrack->GetDir(0) << " " << wcsimroottrack->GetDir(1)
+                     << " " << wcsimroottrack->GetDir(2) << std::endl;
+
+                dump << "Direction bef div : " << wcsimroottrack->GetPdir(0) << " " << wcsimroottrack->GetPdir(1)
+                     << " " << wcsimroottrack->GetPdir(2) << std::endl;
+
+                dump << "ENERGY: " << wcsimroottrack->GetE() << std::endl;
+                dump << "MASS: " << wcsimroottrack->GetM() << std::endl;
+                float diff = wcsimroottrack->GetE() - wcsimroottrack->GetM();
+                dump << "Difference between energy and mass " << diff << std::endl;
+                dump << "Process producing the track " << wcsimroottrack->GetCreatorProcess() << std::endl;
+
+                dump << " ===== END OF TRACK " << j << " =====" << std::endl;
+                LOG_DEBUG(dump.str());
+            }
+        }
     }
 
-    // Get the WCSim tree from the file
-    TTree *wcsim_tree = (TTree *)wcsim_file->Get("wcsimT");
-    TBranch *event_branch = wcsim_tree->GetBranch("wcsimrootevent");
-    WCSimRootEvent *wcsimrootsuperevent = new WCSimRootEvent();
-    event_branch->SetAddress(&wcsimrootsuperevent);
+    input.close();
+    worker.inputStats = input.stats();
+    flushLog();
+    worker.ok = true;
+}
 
-    WCSimRootTrigger *trigger;
+// Draws the counts of a census as a histogram with one labelled bin per entry
+template <class Key, class Label>
+TH1F *countHistogram(const char *name, const std::vector<std::pair<Key, std::uint64_t>> &counts, Label label) {
+    TH1F *hist = new TH1F(name, name, counts.size(), 0, counts.size());
+    int i = 1;
+    for (const auto &count : counts) {
+        hist->GetXaxis()->SetBinLabel(i, label(count.first).c_str());
+        hist->SetBinContent(i, count.second);
+        i++;
+    }
+    return hist;
+}
 
-    // Set number of events to loop over here
-    int nentries = wcsim_tree->GetEntries();
+int main(int argc, char **argv) {
+    // Get arguments - options, then the input file, optionally followed by a name that the output files are
+    // prefixed with, so that jobs run in the same directory do not overwrite each other
+    LogLevel level = LogLevel::Info;
+    unsigned int nThreads = std::max(1u, std::thread::hardware_concurrency());
+    // The process census of the low energy electrons and the particle census of every other track are always made,
+    // further selections are counted in the same read of the file
+    std::vector<TrackSelection> selections(2);
+    parseTrackSelection("lowEnergyElectrons:11::0.8", selections[0]);
+    parseTrackSelection("otherTracks:11::0.8:not", selections[1]);
+    WCSimInputConfig inputConfig;
+    bool prefetch = true;
+    bool badSelection = false;
+    bool badLogLevel = false;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--log-level" && i + 1 < argc) {
+            badLogLevel |= !parseLogLevel(argv[++i], level);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            nThreads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--cache-size" && i + 1 < argc) {
+            inputConfig.cacheSizeMB = std::atof(argv[++i]);
+        } else if (arg == "--no-prefetch") {
+            prefetch = false;
+        } else if (arg == "--select" && i + 1 < argc) {
+            TrackSelection selection;
+            badSelection |= !parseTrackSelection(argv[++i], selection);
+            for (const TrackSelection &other : selections) {
+                badSelection |= other.name == selection.name;
+            }
+            selections.push_back(selection);
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if ((positional.size() != 1 && positional.size() != 2) || inputConfig.cacheSizeMB < 0) {
+        badSelection = true;
+    }
+    if (badSelection || badLogLevel) {
+        std::cerr << "Usage: " << argv[0] << " [--log-level <error|warning|info|debug|trace>] [--threads <n>]"
+                  << " [--cache-size <MB>] [--no-prefetch]"
+                  << " [--select <name>:<pdg>:<min MeV>:<max MeV>[:not]]... <input file> [output name]" << std::endl;
+        std::cerr << "Each --select counts the tracks that pass it by particle and by creator process into"
+                  << " <name>_particles.C and <name>_processes.C, an empty or * field places no cut and :not"
+                  << " counts the tracks that fail it. The names must be unique." << std::endl;
+        return 1;
+    }
+    setLogLevel(level);
+    std::string inputPath = positional[0];
+    std::string outputPrefix = positional.size() == 2 ? positional[1] + "_" : "";
+
+    // Open the file to count the entries, the workers open their own copies
+    Long64_t nentries = 0;
+    {
+        std::unique_ptr<TFile> wcsim_file(TFile::Open(inputPath.c_str(), "READ"));
+        if (!wcsim_file || !wcsim_file->IsOpen()) {
+            std::cerr << "Failed to open file: " << inputPath << std::endl;
+            return 1;
+        }
+        TTree *wcsim_tree = (TTree *)wcsim_file->Get("wcsimT");
+        if (!wcsim_tree) {
+            std::cerr << "Failed to get the wcsimT tree from " << inputPath << std::endl;
+            return 1;
+        }
+        nentries = wcsim_tree->GetEntries();
+    }
     // Print in green
     std::cout << "\033[1;32m" << "Number of entries: " << nentries << "\033[0m" << std::endl;
-    // nentries = 2;
+    if (nentries < nThreads) {
+        nThreads = std::max<Long64_t>(1, nentries);
+    }
+
+    // ROOT is set up for the workers before they open their files, and the histograms of the workers must not be
+    // attached to the file they are reading
+    setUpWCSimThreads(prefetch);
+    TH1::AddDirectory(false);
+
+    // Split the entries into contiguous, nearly equal sized blocks, one per worker
+    std::vector<CensusWorker> results(nThreads);
+    std::vector<std::thread> workers;
+    for (unsigned int worker = 0; worker < nThreads; worker++) {
+        results[worker].census = std::make_unique<TrackCensus>(selections);
+        results[worker].inputConfig = inputConfig;
+        Long64_t begin = (nentries * worker) / nThreads;
+        Long64_t end = (nentries * (worker + 1)) / nThreads;
+        workers.emplace_back(censusEntries, inputPath, begin, end, std::ref(results[worker]));
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
 
+    // Merge the workers in worker order
+    TrackCensus census(selections);
     TH1F *h1 = new TH1F("h1", "h1", 300, 0.5, 0.8);
+    WCSimInputStats inputStats;
+    for (const CensusWorker &result : results) {
+        if (!result.ok) {
+            std::cerr << "Error: a worker failed to read its entries" << std::endl;
+            return 1;
+        }
+        census.merge(*result.census);
+        addToROOT(result.energy, *h1);
+        inputStats.merge(result.inputStats);
+    }
+    LOG_INFO(inputStats.summary());
+    for (std::size_t selection = 0; selection < selections.size(); selection++) {
+        const std::string &name = selections[selection].name;
+        LOG_INFO(census.nPassed(selection) << " of " << census.nTracks() << " tracks pass " << name);
+    }
 
     // Create a map that maps all of the PDG values to the names of the particles
     std::map<int, std::string> pdgToParticleName = {{11, "Electron"},
@@ -78,107 +273,20 @@ int main(int argc, char **argv) {
                                                     {1000020030, "Helium-3"},
                                                     {1000020040, "Alpha"}};
 
-    // Create a map for strings to ints
-    std::map<std::string, int> process_map;
-
-    std::map<int, int> particle_type_map;
-
-    // Loop over the events in the tree
-    for (int event = 0; event < nentries; event++) {
-        // Get the entry in the tree
-        wcsim_tree->GetEntry(event);
-        // Get the trigger
-        trigger = wcsimrootsuperevent->GetTrigger(0);
-
-        std::cout << "There are " << trigger->GetNvtxs() << " vertices in this event" << std::endl;
-        for (int i = 0; i < trigger->GetNvtxs(); i++) {
-            // std::cout << "Vertex " << i << " is at " << trigger->GetVtxs(i, 0) << ", " << trigger->GetVtxs(i, 1)
-            //           << ", " << trigger->GetVtxs(i, 2) << std::endl;
+    auto particleName = [&](int pdg) {
+        auto found = pdgToParticleName.find(pdg);
+        if (found == pdgToParticleName.end()) {
+            LOG_WARNING("Particle not found in map with id " << pdg);
+            return std::string();
         }
-        WCSimRootTrigger *wcsimrootevent = wcsimrootsuperevent->GetTrigger(0);
-
-        int ntrack = wcsimrootevent->GetNtrack();
-
-        for (int j = 0; j < ntrack; j++) {
-            TObject *element = (wcsimrootevent->GetTracks()->At(j));
-
-            WCSimRootTrack *wcsimroottrack = (WCSimRootTrack *)(element);
-
-            h1->Fill(wcsimroottrack->GetE());
-
-            if (!(wcsimroottrack->GetIpnu() == 11 && wcsimroottrack->GetE() < 0.8)) {
-
-                if (particle_type_map.find(wcsimroottrack->GetIpnu()) == particle_type_map.end()) {
-                    particle_type_map[wcsimroottrack->GetIpnu()] = 1;
-                } else {
-                    particle_type_map[wcsimroottrack->GetIpnu()]++;
-                }
-            }
-
-            if (wcsimroottrack->GetIpnu() == 11 && wcsimroottrack->GetE() < 0.8) {
-                std::string process = wcsimroottrack->GetCreatorProcessName();
-                if (process_map.find(process) == process_map.end()) {
-                    process_map[process] = 1;
-                } else {
-                    process_map[process]++;
-                }
-            }
+        LOG_DEBUG("Setting bin " << pdg << " to " << found->second);
+        return found->second;
+    };
+    auto processName = [](const std::string &name) { return name; };
 
-            if ((wcsimroottrack->GetParenttype() == 0)) {
-                std::cout << " ======== TRACK " << j << " ========" << std::endl;
-                std::cout << "Parent type (PDG):  " << wcsimroottrack->GetParenttype() << std::endl;
-
-                std::cout << "Flag:               " << wcsimroottrack->GetFlag() << std::endl;
-
-                std::cout << "PDG:                " << wcsimroottrack->GetIpnu() << std::endl;
-
-                std::cout << "Mass:               " << wcsimroottrack->GetM() << std::endl;
-
-                std::cout << "Position start:    " << wcsimroottrack->GetStart(0) << " "
-                          << wcsimroottrack->GetStart(1) << " " << wcsimroottrack->GetStart(2) << std::endl;
-                std::cout << "Position end:      " << wcsimroottrack->GetStop(0) << " "
-                          << wcsimroottrack->GetStop(1) << " " << wcsimroottrack->GetStop(2) << std::endl;
-                std::cout << "Momentum:           " << wcsimroottrack->GetP() << std::endl;
-
-                std::cout << "Energy:             " << wcsimroottrack->GetE() << std::endl;
-
-                std::cout << "Direction:          " << wcsimroottrack->GetDir(0) << " "
-                          << wcsimroottrack->GetDir(1) << " " << wcsimroottrack->GetDir(2) << std::endl;
-
-                std::cout << "Direction bef div : " << wcsimroottrack->GetPdir(0) << " "
-                          << wcsimroottrack->GetPdir(1) << " " << wcsimroottrack->GetPdir(2) << std::endl;
-
-                std::cout << "ENERGY: " << wcsimroottrack->GetE() << std::endl;
-                std::cout << "MASS: " << wcsimroottrack->GetM() << std::endl;
-                float diff = wcsimroottrack->GetE() - wcsimroottrack->GetM();
-                std::cout << "Difference between energy and mass " << diff << std::endl;
-                std::cout << "Process producing the track " << wcsimroottrack->GetCreatorProcess() << std::endl;
-
-                std::cout << " ===== END OF TRACK " << j << " =====" << std::endl << std::endl;
-            }
-        }
-    }
-
-    // Create a th1f and fill it with the process map values with the process names on the x axis
-    TH1F *h2 = new TH1F("h2", "h2", process_map.size(), 0, process_map.size());
-    int i = 1;
-    for (auto it = process_map.begin(); it != process_map.end(); it++) {
-        h2->GetXaxis()->SetBinLabel(i, it->first.c_str());
-        h2->SetBinContent(i, it->second);
-        i++;
-    }
-
-    i = 1;
-    TH1F *id_hist = new TH1F("id_hist", "id_hist", particle_type_map.size(), 0, particle_type_map.size());
-    for (auto it = particle_type_map.begin(); it != particle_type_map.end(); it++) {
-        std::cout << "Setting bin " << it->first << " to " << pdgToParticleName[it->first] << std::endl;
-        if (pdgToParticleName.find(it->first) == pdgToParticleName.end()) {
-            std::cout << "Particle not found in map with id " << it->first << std::endl;
-        }
-        id_hist->GetXaxis()->SetBinLabel(i, pdgToParticleName[it->first].c_str());
-        id_hist->SetBinContent(i, it->second);
-        i++;
-    }
+    // Create a th1f and fill it with the process counts with the process names on the x axis
+    TH1F *h2 = countHistogram("h2", census.processCounts(0), processName);
+    TH1F *id_hist = countHistogram("id_hist", census.particleCounts(1), particleName);
 
     // don't tilt the x-axis labels
     id_hist->LabelsOption("v");
@@ -189,17 +297,31 @@ int main(int argc, char **argv) {
     // make the y-axis log
     c1->SetLogy();
     h1->Draw();
-    c1->SaveAs("h1.C");
+    c1->SaveAs((outputPrefix + "h1.C").c_str());
     c1->Clear();
 
     id_hist->Draw();
     c1->SetLogy(false);
-    c1->SaveAs("id_hist.pdf");
+    c1->SaveAs((outputPrefix + "id_hist.pdf").c_str());
     c1->Clear();
 
     c1->SetLogy(0);
     h2->Draw();
-    c1->SaveAs("h2.C");
+    c1->SaveAs((outputPrefix + "h2.C").c_str());
+
+    // The extra selections
+    for (std::size_t selection = 2; selection < selections.size(); selection++) {
+        std::string name = selections[selection].name;
+        TH1F *particles = countHistogram((name + "_particles").c_str(), census.particleCounts(selection), particleName);
+        particles->LabelsOption("v");
+        c1->Clear();
+        particles->Draw();
+        c1->SaveAs((outputPrefix + name + "_particles.C").c_str());
+        TH1F *processes = countHistogram((name + "_processes").c_str(), census.processCounts(selection), processName);
+        c1->Clear();
+        processes->Draw();
+        c1->SaveAs((outputPrefix + name + "_processes.C").c_str());
+    }
 
     return 0;
 }
@@ -1,11 +1,18 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <memory>
-#include <numbers>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "RtypesCore.h"
 #include "TBranch.h"
-#include "TCanvas.h"
 #include "TClonesArray.h"
 #include "TCollection.h"
 #include "TFile.h"
@@ -17,231 +24,784 @@
 #include "TTree.h"
 
 #include "WCSimRootEvent.hh"
-#include "WCSimRootGeom.hh"
 
+#include "cherenkov_solver.h"
 #include "dedx.h"
+#include "dedx_estimator.h"
+#include "dedx_reconstructor.h"
+#include "event_pipeline.h"
+#include "flat_event.h"
+#include "hit_skim.h"
+#include "job_inputs.h"
+#include "logger.h"
+#include "partial_result.h"
+#include "pmt_geometry.h"
+#include "solve_cache.h"
+#include "stage_profile.h"
+#include "wcsim_event.h"
+#include "wcsim_geometry.h"
+#include "wcsim_input.h"
+
+// One input file of the job. The entries of all of the inputs are numbered one after the other, so that the job,
+// its shards and its workers can all be given plain ranges of entries.
+struct JobInput {
+    std::string path;
+    Long64_t nEntries = 0;
+    Long64_t offset = 0;              // Job-wide number of the first entry of the file
+    std::unique_ptr<SkimReader> skim; // Only set for skim files, memory-mapped once and shared by the workers
+    std::string cacheKey;             // Key of the input in the solve cache, if there is one
+};
+
+// Histograms filled by a single worker. Every worker owns its own set so that no locking is needed in the hit
+// loop, the sets are summed once all of the workers have finished.
+struct WorkerResult {
+    PartialResult partial;
+    // Filled per hit, and only added into the ROOT histograms of the partial result at the end
+    HitHistograms histograms;
+    // Every worker streams its dE/dx records to its own part file, the parts are joined in worker order at the end
+    std::unique_ptr<DedxReconstructor> reconstructor;
+    WCSimInputConfig inputConfig;
+    bool antiMuons = false;
+    WCSimInputStats inputStats;
+    // Solutions are taken from the cache where it has them, and written to it for the ranges where it does not
+    const SolveCache *cache = nullptr;
+    SolveCacheWriter cacheWriter;
+    bool caching = false;
+    Long64_t cachedEntries = 0;
+    // In a pipelined job the records of each event are handed to the aggregator instead of written to the part file
+    std::vector<DedxRecord> *recordSink = nullptr;
+    // Truncated means of the records written to the part file, in entry order
+    std::vector<double> truncatedMeans;
+    // Only timed when profiling is switched on
+    bool profiling = false;
+    StageProfile profile;
+    std::string recordsPath;
+    std::ofstream records;
+    bool ok = false;
+
+    StageProfile *profiler() { return profiling ? &profile : nullptr; }
+};
+
+// The reader of a pipelined job, which reads and decodes every entry of the job for the solver workers
+struct PipelineReader {
+    WCSimInputConfig inputConfig;
+    bool antiMuons = false;
+    WCSimInputStats inputStats;
+    bool profiling = false;
+    StageProfile profile;
+    bool ok = false;
+};
+
+// Events in flight per solver worker of a pipelined job, enough for the reader to stay ahead of the solvers while
+// they take events of different sizes
+constexpr std::size_t pipelineSlotsPerSolver = 8;
 
 int main(int argc, char **argv) {
 
-    // Get arguments - input WCSim file and output file
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <input WCSim file> <output file>" << std::endl;
+    // Get arguments - options, then the input files and the output name. Each input is either a WCSim file or a
+    // skim file written by the skim program, and can also be a glob pattern or an @list of files.
+    Long64_t firstEntry = 0;
+    Long64_t entryCount = -1;
+    ShardSpec shard;
+    unsigned int nThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::string geometryCachePath;
+    DedxReconstructorConfig reconstructorConfig;
+    DedxEstimatorConfig &estimatorConfig = reconstructorConfig.estimator;
+    PreselectionConfig &preselectionConfig = reconstructorConfig.preselection;
+    LogLevel level = LogLevel::Info;
+    bool discriminantSummary = false;
+    WCSimInputConfig inputConfig;
+    bool prefetch = true;
+    std::string profilePath;
+    std::string solveCachePath;
+    bool pipelined = false;
+    bool antiMuons = false;
+    bool badShard = false;
+    bool badLogLevel = false;
+    bool badSolver = false;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--log-level" && i + 1 < argc) {
+            badLogLevel |= !parseLogLevel(argv[++i], level);
+        } else if (arg == "--solver" && i + 1 < argc) {
+            badSolver = !parseSolverPath(argv[++i], reconstructorConfig.solverPath);
+        } else if (arg == "--discriminant-summary") {
+            discriminantSummary = true;
+        } else if (arg == "--geometry-cache" && i + 1 < argc) {
+            geometryCachePath = argv[++i];
+        } else if (arg == "--shard" && i + 1 < argc) {
+            badShard = !parseShard(argv[++i], shard);
+        } else if (arg == "--solve-cache" && i + 1 < argc) {
+            solveCachePath = argv[++i];
+        } else if (arg == "--pipeline") {
+            pipelined = true;
+        } else if (arg == "--profile" && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (arg == "--cache-size" && i + 1 < argc) {
+            inputConfig.cacheSizeMB = std::atof(argv[++i]);
+        } else if (arg == "--no-prefetch") {
+            prefetch = false;
+        } else if (arg == "--anti-muons") {
+            antiMuons = true;
+        } else if (arg == "--preselect") {
+            preselectionConfig.enabled = true;
+        } else if (arg == "--no-preselect") {
+            preselectionConfig.enabled = false;
+        } else if (arg == "--preselect-margin" && i + 1 < argc) {
+            preselectionConfig.margin = std::atof(argv[++i]);
+        } else if (arg == "--preselect-offset" && i + 1 < argc) {
+            preselectionConfig.timeOffset = std::atof(argv[++i]);
+        } else if (arg == "--bin-width" && i + 1 < argc) {
+            estimatorConfig.binWidth = std::atof(argv[++i]);
+        } else if (arg == "--truncate" && i + 1 < argc) {
+            estimatorConfig.truncationFraction = std::atof(argv[++i]);
+        } else if ((arg == "--first" || arg == "--count" || arg == "--threads") && i + 1 < argc) {
+            long long value = std::atoll(argv[++i]);
+            if (arg == "--first") {
+                firstEntry = value;
+            } else if (arg == "--count") {
+                entryCount = value;
+            } else {
+                nThreads = value > 0 ? value : 1;
+            }
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() < 2 || badShard || badLogLevel || badSolver || firstEntry < 0 ||
+        inputConfig.cacheSizeMB < 0 || preselectionConfig.margin < 0 ||
+        estimatorConfig.binWidth <= 0 || estimatorConfig.truncationFraction < 0 ||
+        estimatorConfig.truncationFraction >= 1) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--first <entry>] [--count <entries>] [--shard <i>/<N>] [--threads <n>] [--pipeline]"
+                  << " [--geometry-cache <file>] [--solve-cache <directory>] [--cache-size <MB>] [--no-prefetch]"
+                  << " [--anti-muons] [--preselect | --no-preselect]"
+                  << " [--preselect-margin <ns>]"
+                  << " [--preselect-offset <ns>] [--bin-width <cm>] [--truncate <fraction>]"
+                  << " [--solver <scalar|avx2|avx512>]"
+                  << " [--log-level <error|warning|info|debug|trace>] [--discriminant-summary] [--profile <file>]"
+                  << " <input WCSim or skim file, glob or @list>... <output name>" << std::endl;
+        std::cerr << "Entries are numbered across all of the inputs, which must share one detector geometry."
+                  << " --first and --count select from them and --shard then takes part i of N of the selection."
+                  << std::endl;
+        std::cerr << "Each of the --threads workers reads and solves its own block of entries, with --pipeline a"
+                  << " reader thread reads every entry for them instead, so that reading overlaps with solving,"
+                  << " and the records are written as they are made" << std::endl;
+        std::cerr << "WCSim files are read through a TTreeCache of --cache-size MB per worker (default "
+                  << WCSimInputConfig().cacheSizeMB << ", 0 turns it off) that is filled ahead of time unless"
+                  << " --no-prefetch is given" << std::endl;
+        std::cerr << "The primary mu- of every event are measured, --anti-muons adds the primary mu+ of the WCSim"
+                  << " inputs. Skim files keep the muons that the skim program selected." << std::endl;
+        std::cerr << "--preselect drops the hits that cannot be direct Cherenkov light from the muon before solving,"
+                  << " with the windows widened by the margin (default " << PreselectionConfig().margin
+                  << " ns) and shifted by the offset. Checking a hit costs about as much as solving it, so it only"
+                  << " pays off when roughly 40% or more of the hits are noise or late light, and is off by default"
+                  << " (--no-preselect)" << std::endl;
+        std::cerr << "--solver picks the emission point solver, all of them give the same solutions. The default is "
+                  << solverPathName(bestSolverPath()) << " on this machine, bin/bench times each of them." << std::endl;
+        std::cerr << "--solve-cache keeps the solved hits of every input in the directory, so that later runs with"
+                  << " the same geometry and preselection only change how they are binned and read them back instead"
+                  << " of solving them again. Inputs or entries not yet in the cache are processed and added to it."
+                  << std::endl;
+        std::cerr << "--profile times the stages of the job on every thread and writes the report to the file, as"
+                  << " JSON if its name ends in .json and as text otherwise" << std::endl;
+        std::cerr << "Writes <output name>.csv with one dE/dx record per muon, the partial result"
+                  << " <output name>.root for the merge program and the <output name>_*.C plots" << std::endl;
         return 1;
     }
-
-    // Load the WCSim file
-    std::string WCSimFilePath = argv[1];
-    std::unique_ptr<TFile> WCSimFile(TFile::Open(WCSimFilePath.c_str(), "READ"));
-    if (!WCSimFile || WCSimFile->IsZombie()) {
-        std::cerr << "Error: failed to open WCSim file" << std::endl;
+    std::string outputBase = positional.back();
+    positional.pop_back();
+    setLogLevel(level);
+    if (!solverPathSupported(reconstructorConfig.solverPath)) {
+        std::cerr << "Error: the " << solverPathName(reconstructorConfig.solverPath)
+                  << " solver is not supported by this CPU" << std::endl;
         return 1;
     }
-
-    // Example: Access a specific tree by name and cycle
-    const char *treeName = "wcsimT"; // Replace with desired tree name
-    int cycle = 1;                   // Replace with desired cycle number
-
-    // Construct the name with cycle and fetch the tree
-    std::string treeWithCycle = std::string(treeName) + ";" + std::to_string(cycle);
-    TTree *wcSimTree = (TTree *)WCSimFile->Get(treeWithCycle.c_str());
-    if (wcSimTree) {
-        std::cout << "Successfully accessed tree '" << treeName << "' with cycle " << cycle << std::endl;
-        std::cout << "Number of entries: " << wcSimTree->GetEntries() << std::endl;
-    } else {
-        std::cerr << "Tree '" << treeName << "' with cycle " << cycle << " not found!" << std::endl;
+    // The main thread times opening the inputs, loading the geometry and writing the results
+    auto wallStart = std::chrono::steady_clock::now();
+    StageProfile mainProfile;
+    StageProfile *mainProfiler = profilePath.empty() ? nullptr : &mainProfile;
+    if (mainProfiler) {
+        ticksPerSecond(); // Calibrate the timers before the workers start
     }
+    // The discriminants are only written by trace messages, which are compiled out below DEDX_LOG_MAX_LEVEL 4
+    reconstructorConfig.keepDiscriminants =
+        discriminantSummary || (DEDX_LOG_MAX_LEVEL >= 4 && logEnabled(LogLevel::Trace));
 
-    // Setup the WCSimRootEvent
-    WCSimRootEvent *wcSimRootSuperEvent = new WCSimRootEvent();
-    TBranch *wcSimRootEventBranch = wcSimTree->GetBranch("wcsimrootevent");
-    wcSimRootEventBranch->SetAddress(&wcSimRootSuperEvent);
-    if (!wcSimRootEventBranch) {
-        std::cerr << "Error: failed to get WCSimRootEvent branch" << std::endl;
+    std::vector<std::string> inputPaths;
+    if (!expandInputs(positional, inputPaths) || inputPaths.empty()) {
+        std::cerr << "Error: no input files" << std::endl;
         return 1;
     }
-    WCSimRootTrigger *wcSimRootEvent;
-
-    TTree *wcSimGeoTree = (TTree *)WCSimFile->Get("wcsimGeoT");
-    if (wcSimGeoTree) {
-        std::cout << "Successfully accessed geometry tree" << std::endl;
-    } else {
-        std::cerr << "Geometry tree not found!" << std::endl;
-    }
-    WCSimRootGeom *geo = 0;
-    wcSimGeoTree->SetBranchAddress("wcsimrootgeom", &geo);
-    wcSimGeoTree->GetEntry(0);
-
-    // Get the number of entries
-    int nEntries = wcSimTree->GetEntries();
-    nEntries = 1;
-    int startEntry = 2;
-
-    TH1D *hitTimeHist = new TH1D("hitTimeHist", "Hit Time Distribution", 3500, 0, 70000);
-    TH2D *hitTimeVsZ = new TH2D("hitTimeVsZ", "Hit Time vs Z", 70, 0, 35, 35, 0, 2000);
-
-    for (int entry = startEntry; entry < startEntry + nEntries; entry++) {
-        std::cout << "Processing entry " << entry << std::endl;
-        double muonEntry[3] = {0, 0, 0};
-        double muonDir[3] = {0, 0, 0};
-        double muonTime = 0.;
-        wcSimTree->GetEntry(entry);
-        wcSimRootEvent = wcSimRootSuperEvent->GetTrigger(0);
-
-        int nTracks = wcSimRootEvent->GetNtrack();
-
-        for (int trackN = 0; trackN < nTracks; trackN++) {
-            TObject *element = wcSimRootEvent->GetTracks()->At(trackN);
-            WCSimRootTrack *wcSimRootTrack = (WCSimRootTrack *)(element);
-            if (wcSimRootTrack->GetFlag() == 0 && wcSimRootTrack->GetParenttype() == 0 &&
-                wcSimRootTrack->GetIpnu() == 13) {
-                muonDir[0] = wcSimRootTrack->GetDir(0);
-                muonDir[1] = wcSimRootTrack->GetDir(1);
-                muonDir[2] = wcSimRootTrack->GetDir(2);
-                muonEntry[0] = wcSimRootTrack->GetStart(0);
-                muonEntry[1] = wcSimRootTrack->GetStart(1);
-                muonEntry[2] = wcSimRootTrack->GetStart(2);
-                muonTime = wcSimRootTrack->GetTime();
-            }
-        }
-
-        int nHits = wcSimRootEvent->GetNcherenkovdigihits();
-        int nDigitHitSlots = wcSimRootEvent->GetNcherenkovdigihits_slots();
-        if (nHits) {
-            for (int NdigiHitEvent = 0; NdigiHitEvent < nDigitHitSlots; NdigiHitEvent++) {
-                std::vector<double> zValues;
-                std::vector<double> tValues;
-                TObject *digitHit = wcSimRootEvent->GetCherenkovDigiHits()->At(NdigiHitEvent);
-                if (!digitHit) {
-                    continue;
+
+    // Count the entries of every input. The geometry is taken from the first input, and is read-only from then on
+    // so that all of the workers share it. Every other input must have the same geometry key as the first, inputs
+    // whose key is not known, skims written before it was recorded, are not checked.
+    std::vector<JobInput> inputs(inputPaths.size());
+    PMTGeometry geometry;
+    std::uint64_t firstGeometryKey = 0;
+    Long64_t nEntries = 0;
+    for (std::size_t i = 0; i < inputs.size(); i++) {
+        JobInput &input = inputs[i];
+        input.path = inputPaths[i];
+        input.offset = nEntries;
+        std::uint64_t geometryKey = 0;
+        if (isSkimFile(input.path)) {
+            // A skim does not hold the geometry, that comes from the sidecar written next to it by the skim
+            // program unless another one is given
+            StageTimer openTimer(mainProfiler, Stage::FileOpen);
+            input.skim = std::make_unique<SkimReader>();
+            if (!input.skim->open(input.path)) {
+                std::cerr << "Error: failed to open skim file " << input.path << std::endl;
+                return 1;
+            }
+            input.nEntries = input.skim->size();
+            geometryKey = input.skim->geometryKey();
+            if (i == 0) {
+                StageTimer geometryTimer(mainProfiler, Stage::GeometryLoad);
+                std::string geometryPath = geometryCachePath.empty() ? input.path + ".pmtgeo" : geometryCachePath;
+                if (!readPMTGeometry(geometry, geometryPath, input.skim->geometryKey())) {
+                    std::cerr << "Error: failed to read geometry cache " << geometryPath << std::endl;
+                    return 1;
+                }
+            }
+        } else {
+            // Each worker opens its own copy of a WCSim file to read the events from
+            std::unique_ptr<TFile> WCSimFile;
+            {
+                StageTimer openTimer(mainProfiler, Stage::FileOpen);
+                WCSimFile.reset(TFile::Open(input.path.c_str(), "READ"));
+                if (!WCSimFile || WCSimFile->IsZombie()) {
+                    std::cerr << "Error: failed to open WCSim file " << input.path << std::endl;
+                    return 1;
                 }
-                WCSimRootCherenkovDigiHit *wcSimRootCherenkovDigiHit =
-                    dynamic_cast<WCSimRootCherenkovDigiHit *>(digitHit);
-                int tubeNumber = wcSimRootCherenkovDigiHit->GetTubeId();
-                double hitTime = wcSimRootCherenkovDigiHit->GetT();
-                WCSimRootPMT pmt = geo->GetPMT(tubeNumber - 1);
-                double hitPos[3] = {pmt.GetPosition(0), pmt.GetPosition(1), pmt.GetPosition(2)};
-                double muonToHit[3] = {hitPos[0] - muonEntry[0], hitPos[1] - muonEntry[1],
-                                       hitPos[2] - muonEntry[2]};
-                double magnitudeR = std::sqrt(pow(muonToHit[0], 2) + pow(muonToHit[1], 2) + pow(muonToHit[2], 2));
-                double a = calculateA();
-                double b = calculateB(muonToHit, muonDir, hitTime, muonTime);
-                double c = calculateC(magnitudeR, hitTime, muonTime);
-                std::vector<double> roots = quadraticFormula(a, b, c);
-                double discriminant = getDiscriminant(a, b, c);
-                if (discriminant < 100 && discriminant > 0) {
-                    std::cout << "There are: " << roots.size()
-                              << " roots to the equation. The discriminant is: " << discriminant << std::endl;
+                TTree *wcSimTree = getWCSimTree(WCSimFile.get());
+                if (!wcSimTree) {
+                    return 1;
                 }
-                if (roots.size()) {
-                    hitTimeHist->Fill(roots[0]);
-                    hitTimeVsZ->Fill(roots[0] / 1000, hitTime);
-                    if (roots.size() == 2) {
-                        hitTimeHist->Fill(roots[1]);
-                        hitTimeVsZ->Fill(roots[1] / 1000, hitTime);
-                    }
+                input.nEntries = wcSimTree->GetEntries();
+                geometryKey = geometrySourceKey(WCSimFile.get());
+            }
+            if (i == 0) {
+                StageTimer geometryTimer(mainProfiler, Stage::GeometryLoad);
+                if (!loadPMTGeometry(WCSimFile.get(), geometryCachePath, geometry)) {
+                    return 1;
                 }
-                double dotProduct =
-                    muonToHit[0] * muonDir[0] + muonToHit[1] * muonDir[1] + muonToHit[2] * muonDir[2];
-            }
-        }
-        // if (nHits) {
-        //     // Print the hit time of the first hit
-        //     TClonesArray *cherenkovHitTimes = wcSimRootEvent->GetCherenkovHitTimes();
-        //     TClonesArray *cherenkovDigitHitTimes = wcSimRootEvent->GetCherenkovDigiHits();
-        //     for (int i = 0; i < nHits; i++) {
-        //         WCSimRootCherenkovHitTime *cherenkovHitTime =
-        //             (WCSimRootCherenkovHitTime *)cherenkovHitTimes->At(i);
-
-        //         double hitPos[3] = {cherenkovHitTime->GetPhotonEndPos(0), cherenkovHitTime->GetPhotonEndPos(1),
-        //                             cherenkovHitTime->GetPhotonEndPos(2)};
-        //         double hitTime = cherenkovHitTime->GetTruetime();
-        //         double muonToHit[3] = {hitPos[0] - muonEntry[0], hitPos[1] - muonEntry[1],
-        //                                hitPos[2] - muonEntry[2]};
-        //         double magnitudeR = std::sqrt(pow(muonToHit[0], 2) + pow(muonToHit[1], 2) + pow(muonToHit[2],
-        //         2)); double a = calculateA(); double b = calculateB(muonToHit, muonDir, hitTime, muonTime);
-        //         double c = calculateC(magnitudeR, hitTime, muonTime);
-        //         std::vector<double> roots = quadraticFormula(a, b, c);
-        //         double discriminant = getDiscriminant(a, b, c);
-        //         if (discriminant < 100 && discriminant > 0) {
-        //             std::cout << "There are: " << roots.size()
-        //                       << " roots to the equation. The discriminant is: " << discriminant << std::endl;
-        //         }
-        //         if (roots.size()) {
-        //             hitTimeHist->Fill(roots[0] / 10);
-        //             if (roots.size() == 2) {
-        //                 hitTimeHist->Fill(roots[1] / 10);
-        //             }
-        //         }
-        //         // hitTimeHist->Fill(hitTime);
-        //     }
-        // }
-    }
-
-    TCanvas *c1 = new TCanvas("c1", "c1", 800, 600);
-    hitTimeHist->Draw();
-    c1->SaveAs("hitTimeHist.C");
-    c1->Clear();
-    hitTimeVsZ->Draw("colz");
-    c1->SaveAs("hitTimeVsZ.C");
+            }
+        }
+        if (i == 0) {
+            firstGeometryKey = geometryKey;
+        } else if (geometryKey && firstGeometryKey && geometryKey != firstGeometryKey) {
+            std::cerr << "Error: " << input.path << " has a different detector geometry from the first input "
+                      << inputs[0].path << std::endl;
+            return 1;
+        } else if (!geometryKey || !firstGeometryKey) {
+            LOG_WARNING("Could not check that " << input.path << " has the same detector geometry as "
+                                                << inputs[0].path);
+        }
+        nEntries += input.nEntries;
+    }
+    std::cout << "Number of entries: " << nEntries << " in " << inputs.size() << " file(s)" << std::endl;
+
+    // The cache does not keep the discriminants, so it cannot be used when they are summarised
+    SolveCache solveCache;
+    bool useSolveCache = !solveCachePath.empty();
+    if (useSolveCache && discriminantSummary) {
+        LOG_WARNING("The solve cache is not used with --discriminant-summary, every entry is solved");
+        useSolveCache = false;
+    }
+    // With the cache the entries are spread over the workers in blocks, so that each block becomes a piece of it
+    if (useSolveCache && pipelined) {
+        LOG_WARNING("The job is not pipelined with --solve-cache, each worker reads its own entries");
+        pipelined = false;
+    }
+    if (useSolveCache) {
+        if (!solveCache.open(solveCachePath, geometry, preselectionConfig, antiMuons)) {
+            return 1;
+        }
+        for (JobInput &input : inputs) {
+            input.cacheKey = solveCache.key(input.path);
+        }
+    }
+
+    // Work out the range of entries to process
+    if (firstEntry > nEntries) {
+        firstEntry = nEntries;
+    }
+    Long64_t lastEntry = nEntries;
+    if (entryCount >= 0 && firstEntry + entryCount < nEntries) {
+        lastEntry = firstEntry + entryCount;
+    }
+    shardRange(shard, firstEntry, lastEntry);
+    Long64_t nToProcess = lastEntry - firstEntry;
+    if (nToProcess < nThreads) {
+        nThreads = std::max<Long64_t>(1, nToProcess);
+    }
+    std::cout << "Processing entries " << firstEntry << " to " << lastEntry << " (shard " << shard.index << "/"
+              << shard.count << ") on " << nThreads << " thread(s)" << (pipelined ? " fed by a reader thread" : "")
+              << std::endl;
+
+    // ROOT is set up for the workers before they open their files
+    setUpWCSimThreads(prefetch);
+
+    // The records go into one file, in entry order. A pipelined job writes them as the events come out of the
+    // pipeline, otherwise each worker writes a part that is added at the end.
+    std::string recordsPath = outputBase + ".csv";
+    std::ofstream records(recordsPath);
+    writeDedxRecordHeader(records);
+    if (!records) {
+        std::cerr << "Error: failed to open " << recordsPath << std::endl;
+        return 1;
+    }
+
+    // Set up every worker before any thread is started, so that a failure here leaves no thread to join
+    std::vector<WorkerResult> results(nThreads);
+    for (unsigned int worker = 0; worker < nThreads; worker++) {
+        results[worker].reconstructor = std::make_unique<DedxReconstructor>(geometry, reconstructorConfig);
+        results[worker].partial.hasDiscriminants = discriminantSummary;
+        results[worker].inputConfig = inputConfig;
+        results[worker].antiMuons = antiMuons;
+        results[worker].profiling = mainProfiler != nullptr;
+        results[worker].cache = useSolveCache ? &solveCache : nullptr;
+        results[worker].partial.bookHistograms();
+        results[worker].recordsPath = recordsPath + ".part" + std::to_string(worker);
+        results[worker].records.open(results[worker].recordsPath);
+        if (!results[worker].records) {
+            std::cerr << "Error: failed to open " << results[worker].recordsPath << std::endl;
+            return 1;
+        }
+    }
+
+    // Split the entries into contiguous, nearly equal sized blocks, one per worker, unless they are all read by
+    // the reader of the pipeline
+    std::vector<std::thread> workers;
+    EventPipeline pipeline(pipelineSlotsPerSolver * nThreads, nThreads);
+    PipelineReader reader;
+    reader.inputConfig = inputConfig;
+    reader.antiMuons = antiMuons;
+    reader.profiling = mainProfiler != nullptr;
+    if (pipelined) {
+        workers.emplace_back(readEvents, std::cref(inputs), firstEntry, lastEntry, std::ref(pipeline),
+                             std::ref(reader));
+    }
+    for (unsigned int worker = 0; worker < nThreads; worker++) {
+        if (pipelined) {
+            workers.emplace_back(solveEvents, std::ref(pipeline), std::ref(results[worker]));
+            continue;
+        }
+        Long64_t begin = firstEntry + (nToProcess * worker) / nThreads;
+        Long64_t end = firstEntry + (nToProcess * (worker + 1)) / nThreads;
+        workers.emplace_back(processRange, std::cref(inputs), begin, end, std::ref(results[worker]));
+    }
+    // The main thread is the aggregator of the pipeline, it puts the records of the events back in entry order.
+    // The dE/dx statistics of the job are accumulated from the records in entry order rather than merged from the
+    // workers, so they do not change with the number of threads or with the order in which the events were solved.
+    RunningStats dedxStats;
+    while (PipelineSlot *slot = pipelined ? pipeline.next() : nullptr) {
+        StageTimer timer(mainProfiler, Stage::Output);
+        for (const DedxRecord &record : slot->records) {
+            writeDedxRecord(records, record);
+            addTruncatedMean(dedxStats, record.truncatedMeanDqdx);
+        }
+        pipeline.release(slot);
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    if (pipelined && !reader.ok) {
+        std::cerr << "Error: failed to read the entries" << std::endl;
+        return 1;
+    }
+    for (const WorkerResult &result : results) {
+        if (!result.ok) {
+            std::cerr << "Error: a worker failed to process its entries" << std::endl;
+            return 1;
+        }
+    }
+
+    // Sum the worker results in worker order into the partial result of the job
+    PartialResult job;
+    job.estimatorConfig = estimatorConfig;
+    job.preselectionConfig = preselectionConfig;
+    job.hasDiscriminants = discriminantSummary;
+    job.bookHistograms();
+    PreselectionCounters preselectionCounters;
+    WCSimInputStats inputStats = reader.inputStats;
+    Long64_t cachedEntries = 0;
+    for (WorkerResult &result : results) {
+        for (double truncatedMean : result.truncatedMeans) {
+            addTruncatedMean(dedxStats, truncatedMean);
+        }
+        result.partial.add(result.histograms);
+        job.merge(result.partial);
+        preselectionCounters.merge(result.reconstructor->preselectionCounters());
+        inputStats.merge(result.inputStats);
+        cachedEntries += result.cachedEntries;
+    }
+    job.dedxStats = dedxStats;
+    job.nEntries = nToProcess;
+    job.recordsFile = recordsPath.substr(recordsPath.find_last_of('/') + 1);
+    for (const JobInput &input : inputs) {
+        Long64_t begin = std::max(firstEntry, input.offset) - input.offset;
+        Long64_t end = std::min(lastEntry, input.offset + input.nEntries) - input.offset;
+        if (begin < end) {
+            job.inputs.push_back(input.path + " [" + std::to_string(begin) + ", " + std::to_string(end) + ")");
+        }
+    }
+
+    // Join the dE/dx record parts in worker order, which is entry order
+    std::uint64_t outputStart = readTicks();
+    for (WorkerResult &result : results) {
+        result.records.close();
+        std::ifstream part(result.recordsPath);
+        records << part.rdbuf();
+        part.close();
+        std::remove(result.recordsPath.c_str());
+    }
+    if (!records) {
+        std::cerr << "Error: failed to write " << recordsPath << std::endl;
+        return 1;
+    }
+    if (!writePartialResult(job, outputBase + ".root")) {
+        return 1;
+    }
+
+    if (inputStats.entries) {
+        LOG_INFO(inputStats.summary());
+    }
+    if (useSolveCache) {
+        LOG_INFO("Took " << cachedEntries << " of " << nToProcess << " entries from the solve cache "
+                         << solveCachePath);
+    }
+    if (preselectionConfig.enabled) {
+        LOG_INFO("Preselection kept " << preselectionCounters.kept() << " of " << preselectionCounters.nHits
+                                      << " hits, " << preselectionCounters.outsideEventWindow
+                                      << " were outside of the event window and "
+                                      << preselectionCounters.outsideConeWindow
+                                      << " outside of the window of their PMT");
+    }
+    if (discriminantSummary) {
+        const DiscriminantCounters &counters = job.discriminantCounters;
+        LOG_INFO("Discriminants: " << counters.negative << " negative, " << counters.zero << " zero, "
+                                   << counters.twoRoots << " with two roots of which " << counters.nearZero
+                                   << " below " << nearZeroDiscriminant);
+    }
+    std::cout << "Measured dE/dx for " << job.dedxStats.count << " muons, truncated mean " << job.dedxStats.mean
+              << " +/- " << job.dedxStats.rms() << " p.e./cm" << std::endl;
+
+    drawPartialResult(job, outputBase);
+
+    if (mainProfiler) {
+        mainProfile.add(Stage::Output, readTicks() - outputStart);
+        std::vector<StageProfile> profiles = {mainProfile};
+        std::vector<std::string> threadNames = {"main"};
+        if (pipelined) {
+            profiles.push_back(reader.profile);
+            threadNames.push_back("reader");
+        }
+        for (std::size_t worker = 0; worker < results.size(); worker++) {
+            const WorkerResult &result = results[worker];
+            profiles.push_back(result.profile);
+            // The preselection counts the hits it rejects anyway
+            const PreselectionCounters &counters = result.reconstructor->preselectionCounters();
+            profiles.back().rejectedHits = counters.outsideEventWindow + counters.outsideConeWindow;
+            threadNames.push_back("worker " + std::to_string(worker));
+        }
+        double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+        if (!writeProfileReport(profilePath, profiles, threadNames, wallSeconds)) {
+            return 1;
+        }
+        std::cout << "Wrote the profile report to " << profilePath << std::endl;
+    }
 
     return 0;
 }
 
-// Returns the roots of the quadratic equation ax^2 + bx + c = 0 if they exist
-std::vector<double> quadraticFormula(double a, double b, double c) {
-    double discriminant = getDiscriminant(a, b, c);
-    std::vector<double> roots;
-    if (discriminant < 0) {
-        return roots;
-    } else if (discriminant == 0) {
-        roots.push_back(-b / (2 * a));
-        return roots;
-    } else {
-        // std::cout << "Discriminant: " << discriminant << std::endl;
-        // std::cout << "Upper fraction + : " << (-b + std::sqrt(discriminant)) << std::endl;
-        // std::cout << "Upper fraction - : " << (-b - std::sqrt(discriminant)) << std::endl;
-        // std::cout << "Lower fraction: " << (2 * a) << std::endl;
-
-        roots.push_back((-b + std::sqrt(discriminant)) / (2 * a));
-        roots.push_back((-b - std::sqrt(discriminant)) / (2 * a));
-        return roots;
+// Processes the job-wide entries [firstEntry, lastEntry) into the results of a single worker, a block of entries
+// can span several of the input files
+void processRange(const std::vector<JobInput> &inputs, Long64_t firstEntry, Long64_t lastEntry,
+                  WorkerResult &result) {
+    for (const JobInput &input : inputs) {
+        Long64_t begin = std::max(firstEntry, input.offset) - input.offset;
+        Long64_t end = std::min(lastEntry, input.offset + input.nEntries) - input.offset;
+        if (begin >= end) {
+            continue;
+        }
+        std::vector<SolveCachePiece> pieces;
+        bool ok = true;
+        if (result.cache && result.cache->find(input.cacheKey, begin, end, pieces)) {
+            ok = replaySolutions(pieces, begin, end, result);
+            result.cachedEntries += end - begin;
+        } else {
+            // Solve the range, and keep the solutions if it is solved in full
+            result.caching = result.cache && !input.cacheKey.empty() &&
+                             result.cacheWriter.open(result.cache->piecePath(input.cacheKey, begin, end));
+            ok = input.skim ? processSkimEvents(*input.skim, begin, end, result)
+                            : processEntries(input.path, begin, end, result);
+            if (result.caching) {
+                if (ok) {
+                    result.cacheWriter.close();
+                } else {
+                    result.cacheWriter.discard();
+                }
+                result.caching = false;
+            }
+        }
+        if (!ok) {
+            return;
+        }
     }
+    flushLog();
+    result.ok = true;
 }
 
-// Returns the discriminant of the quadratic equation ax^2 + bx + c = 0
-double getDiscriminant(double a, double b, double c) { return pow(b, 2) - 4 * a * c; }
+// Processes the entries [firstEntry, lastEntry) of a WCSim file into the results of a single worker
+bool processEntries(std::string WCSimFilePath, Long64_t firstEntry, Long64_t lastEntry, WorkerResult &result) {
+    StageProfile *profile = result.profiler();
+    WCSimInput input;
+    {
+        StageTimer timer(profile, Stage::FileOpen);
+        if (!input.open(WCSimFilePath, result.inputConfig, firstEntry, lastEntry)) {
+            return false;
+        }
+    }
 
-double calculateA() {
-    double a = (1 / pow(ng, 2)) - 1;
-    // std::cout << "A is: " << a << std::endl;
-    return a;
+    FlatEvent event;
+    bool ok = true;
+    for (Long64_t entry = firstEntry; entry < lastEntry && ok; entry++) {
+        LOG_DEBUG("Processing entry " << entry);
+        {
+            StageTimer timer(profile, Stage::ReadEntry);
+            ok = input.read(entry);
+        }
+        if (ok) {
+            {
+                StageTimer timer(profile, Stage::Decode);
+                readFlatEvent(input.event(), entry, event, result.antiMuons);
+            }
+            processEvent(event.view(), result);
+        }
+    }
+
+    input.close();
+    result.inputStats.merge(input.stats());
+    return ok;
+}
+
+// Processes the events [firstEvent, lastEvent) of a skim file into the results of a single worker. The events are
+// used in place in the memory-mapped file, so the workers share one reader.
+bool processSkimEvents(const SkimReader &reader, Long64_t firstEvent, Long64_t lastEvent, WorkerResult &result) {
+    for (Long64_t index = firstEvent; index < lastEvent; index++) {
+        EventView event;
+        {
+            StageTimer timer(result.profiler(), Stage::ReadEntry);
+            event = reader.event(index);
+        }
+        LOG_DEBUG("Processing entry " << event.entry);
+        processEvent(event, result);
+    }
+    return true;
+}
+
+// The reader of a pipelined job: reads and decodes the job-wide entries [firstEntry, lastEntry) into slots of the
+// pipeline, one entry per slot, in entry order
+void readEvents(const std::vector<JobInput> &inputs, Long64_t firstEntry, Long64_t lastEntry, EventPipeline &pipeline,
+                PipelineReader &reader) {
+    StageProfile *profile = reader.profiling ? &reader.profile : nullptr;
+    bool ok = true;
+    for (std::size_t i = 0; i < inputs.size() && ok; i++) {
+        const JobInput &input = inputs[i];
+        Long64_t begin = std::max(firstEntry, input.offset) - input.offset;
+        Long64_t end = std::min(lastEntry, input.offset + input.nEntries) - input.offset;
+        if (begin >= end) {
+            continue;
+        }
+        if (input.skim) {
+            // The events are copied out of the skim, the solvers must not depend on the reader's mapping
+            for (Long64_t index = begin; index < end; index++) {
+                PipelineSlot *slot = pipeline.acquire();
+                StageTimer timer(profile, Stage::Decode);
+                EventView view = input.skim->event(index);
+                FlatEvent &event = slot->event;
+                event.entry = view.entry;
+                event.muons.assign(view.muons, view.muons + view.nMuons);
+                event.tubeId.assign(view.tubeId, view.tubeId + view.nHits);
+                event.time.assign(view.time, view.time + view.nHits);
+                event.charge.assign(view.charge, view.charge + view.nHits);
+                timer.stop();
+                pipeline.submit(slot);
+            }
+            continue;
+        }
+        WCSimInput wcsim;
+        {
+            StageTimer timer(profile, Stage::FileOpen);
+            ok = wcsim.open(input.path, reader.inputConfig, begin, end);
+        }
+        for (Long64_t entry = begin; entry < end && ok; entry++) {
+            {
+                StageTimer timer(profile, Stage::ReadEntry);
+                ok = wcsim.read(entry);
+            }
+            if (ok) {
+                // The slot is only taken once the entry is read, so the solvers are never held up by the read
+                PipelineSlot *slot = pipeline.acquire();
+                {
+                    StageTimer timer(profile, Stage::Decode);
+                    readFlatEvent(wcsim.event(), entry, slot->event, reader.antiMuons);
+                }
+                pipeline.submit(slot);
+            }
+        }
+        wcsim.close();
+        reader.inputStats.merge(wcsim.stats());
+    }
+    pipeline.finishReading();
+    flushLog();
+    reader.ok = ok;
 }
 
-double calculateB(double muonToHit[3], double muonEntry[3], double hitTime, double muonEntryTime) {
-    double dotProduct = muonToHit[0] * muonEntry[0] + muonToHit[1] * muonEntry[1] + muonToHit[2] * muonEntry[2];
-    double b = 2 * (dotProduct - (cVac * (hitTime - muonEntryTime)) / pow(ng, 2));
-    // std::cout << "B is: " << b << std::endl;
-    return b;
+// A solver worker of a pipelined job: reconstructs the events that the reader hands out until there are none left
+void solveEvents(EventPipeline &pipeline, WorkerResult &result) {
+    while (PipelineSlot *slot = pipeline.take()) {
+        result.recordSink = &slot->records;
+        processEvent(slot->event.view(), result);
+        pipeline.complete(slot);
+    }
+    result.recordSink = nullptr;
+    pipeline.finishSolving();
+    flushLog();
+    result.ok = true;
 }
 
-double calculateC(double magnitudeR, double hitTime, double muonEntryTime) {
-    std::cout << "magnitudeR: " << magnitudeR << std::endl;
-    double c = ((pow(cVac, 2) * pow((hitTime - muonEntryTime), 2)) / pow(ng, 2)) - pow(magnitudeR, 2);
-    // std::cout << "C is: " << c << std::endl;
-    return c;
+// Streams the solutions of the entries [firstEntry, lastEntry) of an input back from the pieces of the solve cache
+// that cover them, in place of reading and solving the entries again
+bool replaySolutions(const std::vector<SolveCachePiece> &pieces, Long64_t firstEntry, Long64_t lastEntry,
+                     WorkerResult &result) {
+    StageProfile *profile = result.profiler();
+    SolvedHits &hits = result.reconstructor->restoreHits();
+    SolveCacheReader reader;
+    CachedEvent event;
+    Long64_t entry = firstEntry;
+    for (const SolveCachePiece &piece : pieces) {
+        if (!reader.open(piece.path) || reader.size() != std::uint64_t(piece.end - piece.begin)) {
+            LOG_ERROR("The solve cache piece " << piece.path << " is not complete");
+            return false;
+        }
+        bool ok = true;
+        for (Long64_t index = piece.begin; index < entry && ok; index++) {
+            ok = reader.skip();
+        }
+        for (; entry < std::min<Long64_t>(piece.end, lastEntry) && ok; entry++) {
+            {
+                StageTimer timer(profile, Stage::ReadEntry);
+                ok = reader.next(event, hits);
+            }
+            if (ok) {
+                result.reconstructor->restorePreselectionCounters(event.preselection);
+                useSolvedHits(event.entry, event.nHits, event.muons.data(), event.muons.size(), result);
+            }
+        }
+        if (!ok) {
+            LOG_ERROR("Failed to read the solve cache piece " << piece.path);
+            return false;
+        }
+    }
+    return true;
 }
 
-double calculateZ(double longDist, double muonToHit[3], double muonDir[3]) {
-    double magnitudeR = std::sqrt(pow(muonToHit[0], 2) + pow(muonToHit[1], 2) + pow(muonToHit[2], 2));
-    double dotProduct = muonToHit[0] * muonDir[0] + muonToHit[1] * muonDir[1] + muonToHit[2] * muonDir[2];
-    double z = longDist + 34000 * sin(acos(dotProduct / magnitudeR)) * (1 / tan(42 * TMath::Pi() / 180));
-    return z;
+// Solves the emission points of every hit of an event and fills them into the worker's histograms
+void processEvent(const EventView &event, WorkerResult &result) {
+    DedxReconstructor &reconstructor = *result.reconstructor;
+    StageProfile *profile = result.profiler();
+    // The hits are gathered once and solved against every muon of the event in one pass. Events without a primary
+    // muon are solved against a track at rest at the origin, and without preselection.
+    PreselectionCounters before = reconstructor.preselectionCounters();
+    {
+        StageTimer timer(profile, Stage::Gather);
+        if (event.nMuons) {
+            reconstructor.gather(event, event.muons, event.nMuons);
+        } else {
+            reconstructor.gather(event);
+        }
+    }
+    {
+        StageTimer timer(profile, Stage::Solve);
+        if (event.nMuons) {
+            reconstructor.solve(event.muons, event.nMuons);
+        } else {
+            reconstructor.solve(MuonTrack{{0, 0, 0}, {0, 0, 0}, 0.});
+        }
+    }
+    if (result.caching) {
+        StageTimer timer(profile, Stage::Output);
+        result.cacheWriter.addEvent(event, reconstructor.hits(), reconstructor.preselectionCounters().since(before));
+    }
+    useSolvedHits(event.entry, event.nHits, event.muons, event.nMuons, result);
 }
 
-double calculateT(double longDist, double muonToHit[3], double muonDir[3]) {
-    double magnitudeR = std::sqrt(pow(muonToHit[0], 2) + pow(muonToHit[1], 2) + pow(muonToHit[2], 2));
-    double dotProduct = muonToHit[0] * muonDir[0] + muonToHit[1] * muonDir[1] + muonToHit[2] * muonDir[2];
-    double t =
-        (1 / cVac) * (longDist + 34000 * sin(acos(dotProduct / magnitudeR))) * (ng / sin(42 * TMath::Pi() / 180));
-    return t;
+// Fills the hits of an event, as last solved or restored by the reconstructor, into the worker's histograms and
+// measures the dE/dx of each of its muons
+void useSolvedHits(std::int64_t entry, std::size_t nHits, const MuonKinematics *muons, std::size_t nMuons,
+                   WorkerResult &result) {
+    DedxReconstructor &reconstructor = *result.reconstructor;
+    StageProfile *profile = result.profiler();
+    const SolvedHits &hits = reconstructor.hits();
+
+    StageTimer fillTimer(profile, Stage::Fill);
+    std::uint64_t validRoots = 0;
+    auto &hitTimeHist = result.histograms.hitTime;
+    auto &hitTimeVsZ = result.histograms.hitTimeVsZ;
+    // Only the pairs of a hit and a track that it can belong to are counted, as in the histograms
+    bool countDiscriminants = result.partial.hasDiscriminants && !hits.discriminant.empty();
+    DiscriminantCounters &discriminantCounters = result.partial.discriminantCounters;
+    for (std::size_t track = 0; track < hits.nTracks; track++) {
+        std::size_t offset = track * hits.size();
+        for (std::size_t hit = 0; hit < hits.size(); hit++) {
+            if (!hits.onTrack(track, hit)) {
+                continue;
+            }
+            std::size_t row = offset + hit;
+            if (countDiscriminants) {
+                discriminantCounters.add(hits.discriminant[row]);
+            }
+            if (!hits.discriminant.empty()) {
+                LOG_TRACE("There are: " << int(hits.nRoots[row])
+                                        << " roots to the equation. The discriminant is: " << hits.discriminant[row]);
+            }
+            if (hits.nRoots[row]) {
+                validRoots++;
+                hitTimeHist.fill(hits.rootPlus[row]);
+                hitTimeVsZ.fill(hits.rootPlus[row] / 1000, hits.t[hit]);
+                if (hits.nRoots[row] == 2) {
+                    hitTimeHist.fill(hits.rootMinus[row]);
+                    hitTimeVsZ.fill(hits.rootMinus[row] / 1000, hits.t[hit]);
+                }
+            }
+        }
+    }
+
+    fillTimer.stop();
+
+    // Bin the charge along each muon track and emit its dE/dx record
+    {
+        StageTimer timer(profile, Stage::Measure);
+        for (std::size_t muon = 0; muon < nMuons; muon++) {
+            DedxRecord record = reconstructor.measure(entry, muon, muons[muon], muon);
+            if (result.recordSink) {
+                result.recordSink->push_back(record);
+            } else {
+                writeDedxRecord(result.records, record);
+                result.truncatedMeans.push_back(record.truncatedMeanDqdx);
+            }
+        }
+    }
+
+    if (profile) {
+        profile->events++;
+        profile->hits += nHits;
+        profile->solvedHits += hits.size() * hits.nTracks;
+        profile->validRoots += validRoots;
+    }
 }
@@ -0,0 +1,104 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dedx_estimator.h"
+#include "job_inputs.h"
+#include "logger.h"
+#include "partial_result.h"
+
+// Returns the directory part of a path, including the trailing slash, or an empty string if there is none
+std::string directoryOf(const std::string &path) {
+    std::size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+int main(int argc, char **argv) {
+    // Get arguments - the partial results to merge, then the output name, in the same order as dedx
+    LogLevel level = LogLevel::Info;
+    bool badLogLevel = false;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--log-level" && i + 1 < argc) {
+            badLogLevel |= !parseLogLevel(argv[++i], level);
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    std::vector<std::string> partialPaths;
+    if (positional.size() < 2 || badLogLevel ||
+        !expandInputs(std::vector<std::string>(positional.begin(), positional.end() - 1), partialPaths)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--log-level <error|warning|info|debug|trace>] <partial result, glob or @list>..."
+                  << " <output name>" << std::endl;
+        std::cerr << "Merges the partial results written by dedx, or by earlier merges, into <output name>.root,"
+                  << " joins their dE/dx records in the order given into <output name>.csv and draws the"
+                  << " <output name>_*.C plots" << std::endl;
+        return 1;
+    }
+    std::string outputBase = positional.back();
+    setLogLevel(level);
+
+    std::string recordsPath = outputBase + ".csv";
+    std::ofstream records(recordsPath);
+    writeDedxRecordHeader(records);
+
+    PartialResult merged;
+    for (std::size_t i = 0; i < partialPaths.size(); i++) {
+        PartialResult partial;
+        if (!readPartialResult(partial, partialPaths[i])) {
+            return 1;
+        }
+        if (i == 0) {
+            merged.estimatorConfig = partial.estimatorConfig;
+            merged.preselectionConfig = partial.preselectionConfig;
+            merged.ng = partial.ng;
+            merged.cVac = partial.cVac;
+            merged.hasDiscriminants = partial.hasDiscriminants;
+            merged.bookHistograms();
+        }
+        std::string reason;
+        if (!merged.compatible(partial, reason)) {
+            std::cerr << "Error: cannot merge " << partialPaths[i] << " with " << partialPaths[0] << ", " << reason
+                      << std::endl;
+            return 1;
+        }
+        merged.merge(partial);
+
+        // Append the records of the partial result without their header. The merged result counts the entries and
+        // muons of every partial, so its records must all be there too.
+        std::string partRecordsPath = directoryOf(partialPaths[i]) + partial.recordsFile;
+        std::ifstream part(partRecordsPath);
+        std::string header;
+        if (partial.recordsFile.empty() || !std::getline(part, header)) {
+            std::cerr << "Error: no dE/dx records found for " << partialPaths[i] << " at " << partRecordsPath
+                      << std::endl;
+            return 1;
+        }
+        if (part.peek() != std::ifstream::traits_type::eof()) {
+            records << part.rdbuf();
+        } else if (partial.dedxStats.count > 0) {
+            std::cerr << "Error: " << partRecordsPath << " has no dE/dx records, but " << partialPaths[i]
+                      << " measured " << partial.dedxStats.count << " muons" << std::endl;
+            return 1;
+        }
+    }
+    merged.recordsFile = recordsPath.substr(recordsPath.find_last_of('/') + 1);
+
+    if (!records) {
+        std::cerr << "Error: failed to write " << recordsPath << std::endl;
+        return 1;
+    }
+    if (!writePartialResult(merged, outputBase + ".root")) {
+        return 1;
+    }
+    std::cout << "Merged " << partialPaths.size() << " partial results covering " << merged.nEntries
+              << " entries, dE/dx for " << merged.dedxStats.count << " muons, truncated mean "
+              << merged.dedxStats.mean << " +/- " << merged.dedxStats.rms() << " p.e./cm" << std::endl;
+
+    drawPartialResult(merged, outputBase);
+
+    return 0;
+}
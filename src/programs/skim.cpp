@@ -0,0 +1,81 @@
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "RtypesCore.h"
+#include "TBranch.h"
+#include "TFile.h"
+#include "TTree.h"
+
+#include "WCSimRootEvent.hh"
+
+#include "flat_event.h"
+#include "hit_skim.h"
+#include "pmt_geometry.h"
+#include "wcsim_event.h"
+#include "wcsim_geometry.h"
+#include "wcsim_input.h"
+
+// Extracts what the dE/dx reconstruction needs from a WCSim file - the primary muon kinematics of every event and
+// the tube ID, time and charge of every digitised hit - into a skim file that dedx can read in place. The PMT
+// geometry is written next to it as <output skim file>.pmtgeo.
+int main(int argc, char **argv) {
+
+    // Get arguments - input WCSim file and output skim file
+    bool antiMuons = argc == 4 && std::string(argv[1]) == "--anti-muons";
+    if (argc != 3 + antiMuons) {
+        std::cerr << "Usage: " << argv[0] << " [--anti-muons] <input WCSim file> <output skim file>" << std::endl;
+        std::cerr << "The primary mu- of every event are kept, --anti-muons keeps the primary mu+ as well" << std::endl;
+        return 1;
+    }
+    std::string WCSimFilePath = argv[1 + antiMuons];
+    std::string skimFilePath = argv[2 + antiMuons];
+
+    // Every entry is read in order
+    setWCSimPrefetch(true);
+    WCSimInput input;
+    if (!input.open(WCSimFilePath, WCSimInputConfig())) {
+        std::cerr << "Error: failed to open WCSim file" << std::endl;
+        return 1;
+    }
+
+    PMTGeometry geometry;
+    if (!loadPMTGeometry(input.file(), geometry)) {
+        return 1;
+    }
+    std::uint64_t geometryKey = geometrySourceKey(input.file());
+    if (!writePMTGeometry(geometry, skimFilePath + ".pmtgeo", geometryKey)) {
+        std::cerr << "Error: failed to write geometry to " << skimFilePath << ".pmtgeo" << std::endl;
+        return 1;
+    }
+
+    SkimWriter writer;
+    if (!writer.open(skimFilePath, geometryKey)) {
+        std::cerr << "Error: failed to open skim file " << skimFilePath << std::endl;
+        return 1;
+    }
+
+    Long64_t nEntries = input.entries();
+    std::cout << "Number of entries: " << nEntries << std::endl;
+    FlatEvent event;
+    std::size_t nHits = 0;
+    for (Long64_t entry = 0; entry < nEntries; entry++) {
+        if (!input.read(entry)) {
+            return 1;
+        }
+        readFlatEvent(input.event(), entry, event, antiMuons);
+        writer.addEvent(event.view());
+        nHits += event.tubeId.size();
+    }
+
+    if (!writer.close()) {
+        std::cerr << "Error: failed to write skim file " << skimFilePath << std::endl;
+        return 1;
+    }
+    std::cout << "Wrote " << nEntries << " events with " << nHits << " hits to " << skimFilePath << std::endl;
+    input.close();
+    std::cout << input.stats().summary() << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,303 @@
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DEDX_SOLVER_X86 1
+#include <immintrin.h>
+#endif
+
+#include "cherenkov_solver.h"
+
+// Every path must give the same answer for the same hit, so the compiler must not fuse the multiplies and adds into
+// FMA instructions on the paths where they happen to be available. The Makefile passes -ffp-contract=off for GCC,
+// which has no pragma for this that does not also reset the other optimisation options.
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+
+namespace {
+
+constexpr double missingRoot = std::numeric_limits<double>::quiet_NaN();
+
+// Tracks are solved in groups of at most this many per pass over the hits, so that their constants stay in
+// registers or at worst in L1
+constexpr std::size_t tracksPerPass = 8;
+
+// The kernels are instantiated once for a single track, with the track loops removed at compile time so that the
+// common case is as fast as a kernel written for one track, and once for any number of tracks
+
+// Solves the hits [begin, end) one at a time against every track. This is both the fallback for CPUs without AVX2
+// and the tail of the vectorised paths, it has no branches in the loop body so the compiler is free to vectorise it
+// as well.
+template <bool SingleTrack>
+void solveScalar(const MuonTrack *tracks, std::size_t nTracks, const HitBatch &hits, const SolverOutput *out,
+                 std::size_t begin, std::size_t end) {
+    if (SingleTrack) {
+        nTracks = 1;
+    }
+    for (std::size_t i = begin; i < end; i++) {
+        double x = hits.x[i];
+        double y = hits.y[i];
+        double z = hits.z[i];
+        double t = hits.t[i];
+        for (std::size_t k = 0; k < nTracks; k++) {
+            const MuonTrack &track = tracks[k];
+            double dx = x - track.entry[0];
+            double dy = y - track.entry[1];
+            double dz = z - track.entry[2];
+            double dt = t - track.time;
+            double dot = dx * track.dir[0] + dy * track.dir[1] + dz * track.dir[2];
+            double r2 = dx * dx + dy * dy + dz * dz;
+            double b = 2 * dot - solverTwoCOverNg2 * dt;
+            double c = solverC2OverNg2 * dt * dt - r2;
+            double discriminant = b * b - solverFourA * c;
+            // Taking the square root of a negative number is slow, it sets errno and raises a floating point
+            // exception, so clamp it and mark the roots as missing afterwards
+            double sqrtDiscriminant = std::sqrt(std::fmax(discriminant, 0.));
+            bool real = discriminant >= 0;
+            out[k].rootPlus[i] = real ? (sqrtDiscriminant - b) * solverInverseTwoA : missingRoot;
+            out[k].rootMinus[i] = real ? (-sqrtDiscriminant - b) * solverInverseTwoA : missingRoot;
+            out[k].nRoots[i] = (discriminant > 0) ? 2 : (discriminant == 0 ? 1 : 0);
+            if (out[k].discriminant) {
+                out[k].discriminant[i] = discriminant;
+            }
+        }
+    }
+}
+
+#ifdef DEDX_SOLVER_X86
+
+// The track parameters broadcast to every lane, made once per pass rather than once per block of hits
+struct TrackVectorsAVX2 {
+    __m256d entryX, entryY, entryZ;
+    __m256d dirX, dirY, dirZ;
+    __m256d t0;
+};
+
+struct TrackVectorsAVX512 {
+    __m512d entryX, entryY, entryZ;
+    __m512d dirX, dirY, dirZ;
+    __m512d t0;
+};
+
+template <bool SingleTrack>
+__attribute__((target("avx2"))) void solveAVX2(const MuonTrack *tracks, std::size_t nTracks, const HitBatch &hits,
+                                                const SolverOutput *out) {
+    const __m256d two = _mm256_set1_pd(2);
+    const __m256d twoCOverNg2 = _mm256_set1_pd(solverTwoCOverNg2);
+    const __m256d c2OverNg2 = _mm256_set1_pd(solverC2OverNg2);
+    const __m256d fourA = _mm256_set1_pd(solverFourA);
+    const __m256d inverseTwoA = _mm256_set1_pd(solverInverseTwoA);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d missing = _mm256_set1_pd(missingRoot);
+
+    std::size_t i = 0;
+    for (std::size_t first = 0; first < nTracks; first += tracksPerPass) {
+        std::size_t nPass = SingleTrack ? 1 : nTracks - first < tracksPerPass ? nTracks - first : tracksPerPass;
+        TrackVectorsAVX2 vectors[tracksPerPass];
+        for (std::size_t k = 0; k < nPass; k++) {
+            const MuonTrack &track = tracks[first + k];
+            vectors[k] = {_mm256_set1_pd(track.entry[0]), _mm256_set1_pd(track.entry[1]),
+                          _mm256_set1_pd(track.entry[2]), _mm256_set1_pd(track.dir[0]),
+                          _mm256_set1_pd(track.dir[1]),   _mm256_set1_pd(track.dir[2]),
+                          _mm256_set1_pd(track.time)};
+        }
+        for (i = 0; i + 4 <= hits.size; i += 4) {
+            // Load the block of hits once and solve it against every track of the pass
+            __m256d x = _mm256_loadu_pd(hits.x + i);
+            __m256d y = _mm256_loadu_pd(hits.y + i);
+            __m256d z = _mm256_loadu_pd(hits.z + i);
+            __m256d t = _mm256_loadu_pd(hits.t + i);
+            for (std::size_t k = 0; k < nPass; k++) {
+                const TrackVectorsAVX2 &track = vectors[k];
+                const SolverOutput &output = out[first + k];
+                __m256d dx = _mm256_sub_pd(x, track.entryX);
+                __m256d dy = _mm256_sub_pd(y, track.entryY);
+                __m256d dz = _mm256_sub_pd(z, track.entryZ);
+                __m256d dt = _mm256_sub_pd(t, track.t0);
+                __m256d dot = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, track.dirX), _mm256_mul_pd(dy, track.dirY)),
+                                            _mm256_mul_pd(dz, track.dirZ));
+                __m256d r2 =
+                    _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+                __m256d b = _mm256_sub_pd(_mm256_mul_pd(two, dot), _mm256_mul_pd(twoCOverNg2, dt));
+                __m256d c = _mm256_sub_pd(_mm256_mul_pd(_mm256_mul_pd(c2OverNg2, dt), dt), r2);
+                __m256d discriminant = _mm256_sub_pd(_mm256_mul_pd(b, b), _mm256_mul_pd(fourA, c));
+                __m256d real = _mm256_cmp_pd(discriminant, zero, _CMP_GE_OQ);
+                __m256d sqrtDiscriminant = _mm256_sqrt_pd(_mm256_max_pd(discriminant, zero));
+                __m256d rootPlus = _mm256_mul_pd(_mm256_sub_pd(sqrtDiscriminant, b), inverseTwoA);
+                __m256d rootMinus =
+                    _mm256_mul_pd(_mm256_sub_pd(_mm256_sub_pd(zero, sqrtDiscriminant), b), inverseTwoA);
+                _mm256_storeu_pd(output.rootPlus + i, _mm256_blendv_pd(missing, rootPlus, real));
+                _mm256_storeu_pd(output.rootMinus + i, _mm256_blendv_pd(missing, rootMinus, real));
+                int positive = _mm256_movemask_pd(_mm256_cmp_pd(discriminant, zero, _CMP_GT_OQ));
+                int isZero = _mm256_movemask_pd(_mm256_cmp_pd(discriminant, zero, _CMP_EQ_OQ));
+                for (int lane = 0; lane < 4; lane++) {
+                    output.nRoots[i + lane] = ((positive >> lane) & 1) ? 2 : ((isZero >> lane) & 1);
+                }
+                if (output.discriminant) {
+                    _mm256_storeu_pd(output.discriminant + i, discriminant);
+                }
+            }
+        }
+    }
+    solveScalar<SingleTrack>(tracks, nTracks, hits, out, i, hits.size);
+}
+
+template <bool SingleTrack>
+__attribute__((target("avx512f"))) void solveAVX512(const MuonTrack *tracks, std::size_t nTracks,
+                                                     const HitBatch &hits, const SolverOutput *out) {
+    const __m512d two = _mm512_set1_pd(2);
+    const __m512d twoCOverNg2 = _mm512_set1_pd(solverTwoCOverNg2);
+    const __m512d c2OverNg2 = _mm512_set1_pd(solverC2OverNg2);
+    const __m512d fourA = _mm512_set1_pd(solverFourA);
+    const __m512d inverseTwoA = _mm512_set1_pd(solverInverseTwoA);
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d missing = _mm512_set1_pd(missingRoot);
+
+    std::size_t i = 0;
+    for (std::size_t first = 0; first < nTracks; first += tracksPerPass) {
+        std::size_t nPass = SingleTrack ? 1 : nTracks - first < tracksPerPass ? nTracks - first : tracksPerPass;
+        TrackVectorsAVX512 vectors[tracksPerPass];
+        for (std::size_t k = 0; k < nPass; k++) {
+            const MuonTrack &track = tracks[first + k];
+            vectors[k] = {_mm512_set1_pd(track.entry[0]), _mm512_set1_pd(track.entry[1]),
+                          _mm512_set1_pd(track.entry[2]), _mm512_set1_pd(track.dir[0]),
+                          _mm512_set1_pd(track.dir[1]),   _mm512_set1_pd(track.dir[2]),
+                          _mm512_set1_pd(track.time)};
+        }
+        for (i = 0; i + 8 <= hits.size; i += 8) {
+            // Load the block of hits once and solve it against every track of the pass
+            __m512d x = _mm512_loadu_pd(hits.x + i);
+            __m512d y = _mm512_loadu_pd(hits.y + i);
+            __m512d z = _mm512_loadu_pd(hits.z + i);
+            __m512d t = _mm512_loadu_pd(hits.t + i);
+            for (std::size_t k = 0; k < nPass; k++) {
+                const TrackVectorsAVX512 &track = vectors[k];
+                const SolverOutput &output = out[first + k];
+                __m512d dx = _mm512_sub_pd(x, track.entryX);
+                __m512d dy = _mm512_sub_pd(y, track.entryY);
+                __m512d dz = _mm512_sub_pd(z, track.entryZ);
+                __m512d dt = _mm512_sub_pd(t, track.t0);
+                __m512d dot = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, track.dirX), _mm512_mul_pd(dy, track.dirY)),
+                                            _mm512_mul_pd(dz, track.dirZ));
+                __m512d r2 =
+                    _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), _mm512_mul_pd(dz, dz));
+                __m512d b = _mm512_sub_pd(_mm512_mul_pd(two, dot), _mm512_mul_pd(twoCOverNg2, dt));
+                __m512d c = _mm512_sub_pd(_mm512_mul_pd(_mm512_mul_pd(c2OverNg2, dt), dt), r2);
+                __m512d discriminant = _mm512_sub_pd(_mm512_mul_pd(b, b), _mm512_mul_pd(fourA, c));
+                __mmask8 real = _mm512_cmp_pd_mask(discriminant, zero, _CMP_GE_OQ);
+                __m512d sqrtDiscriminant = _mm512_sqrt_pd(_mm512_max_pd(discriminant, zero));
+                __m512d rootPlus = _mm512_mul_pd(_mm512_sub_pd(sqrtDiscriminant, b), inverseTwoA);
+                __m512d rootMinus =
+                    _mm512_mul_pd(_mm512_sub_pd(_mm512_sub_pd(zero, sqrtDiscriminant), b), inverseTwoA);
+                _mm512_storeu_pd(output.rootPlus + i, _mm512_mask_blend_pd(real, missing, rootPlus));
+                _mm512_storeu_pd(output.rootMinus + i, _mm512_mask_blend_pd(real, missing, rootMinus));
+                __mmask8 positive = _mm512_cmp_pd_mask(discriminant, zero, _CMP_GT_OQ);
+                __mmask8 isZero = _mm512_cmp_pd_mask(discriminant, zero, _CMP_EQ_OQ);
+                for (int lane = 0; lane < 8; lane++) {
+                    output.nRoots[i + lane] = ((positive >> lane) & 1) ? 2 : ((isZero >> lane) & 1);
+                }
+                if (output.discriminant) {
+                    _mm512_storeu_pd(output.discriminant + i, discriminant);
+                }
+            }
+        }
+    }
+    solveScalar<SingleTrack>(tracks, nTracks, hits, out, i, hits.size);
+}
+
+#endif
+
+} // namespace
+
+void DiscriminantCounters::add(const double *discriminants, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) {
+        add(discriminants[i]);
+    }
+}
+
+void DiscriminantCounters::merge(const DiscriminantCounters &other) {
+    negative += other.negative;
+    zero += other.zero;
+    twoRoots += other.twoRoots;
+    nearZero += other.nearZero;
+}
+
+bool solverPathSupported(SolverPath path) {
+    switch (path) {
+    case SolverPath::Scalar:
+        return true;
+#ifdef DEDX_SOLVER_X86
+    case SolverPath::AVX2:
+        return __builtin_cpu_supports("avx2");
+    case SolverPath::AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+SolverPath bestSolverPath() {
+    // AVX2 is preferred over AVX-512 even where both are supported. The solver is bound by its divisions and square
+    // roots rather than by the width of the vectors, and with the lower clock that the 512 bit units run at, the
+    // AVX-512 path was measured at about the speed of the AVX2 path on some machines and at less than half of it on
+    // others.
+    // bin/bench times both on the machine at hand and dedx --solver picks one. Checking the CPU features is cheap
+    // but not free, so only do it once.
+    static const SolverPath best = solverPathSupported(SolverPath::AVX2)     ? SolverPath::AVX2
+                                   : solverPathSupported(SolverPath::AVX512) ? SolverPath::AVX512
+                                                                             : SolverPath::Scalar;
+    return best;
+}
+
+bool parseSolverPath(const std::string &name, SolverPath &path) {
+    for (SolverPath candidate : {SolverPath::Scalar, SolverPath::AVX2, SolverPath::AVX512}) {
+        if (name == solverPathName(candidate)) {
+            path = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *solverPathName(SolverPath path) {
+    switch (path) {
+    case SolverPath::AVX2:
+        return "avx2";
+    case SolverPath::AVX512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+void solveEmissionPoints(const MuonTrack &track, const HitBatch &hits, const SolverOutput &out) {
+    solveEmissionPoints(&track, 1, hits, &out, bestSolverPath());
+}
+
+void solveEmissionPoints(const MuonTrack &track, const HitBatch &hits, const SolverOutput &out, SolverPath path) {
+    solveEmissionPoints(&track, 1, hits, &out, path);
+}
+
+void solveEmissionPoints(const MuonTrack *tracks, std::size_t nTracks, const HitBatch &hits, const SolverOutput *out,
+                         SolverPath path) {
+    if (!nTracks) {
+        return;
+    }
+    bool single = nTracks == 1;
+    switch (path) {
+#ifdef DEDX_SOLVER_X86
+    case SolverPath::AVX512:
+        single ? solveAVX512<true>(tracks, nTracks, hits, out) : solveAVX512<false>(tracks, nTracks, hits, out);
+        return;
+    case SolverPath::AVX2:
+        single ? solveAVX2<true>(tracks, nTracks, hits, out) : solveAVX2<false>(tracks, nTracks, hits, out);
+        return;
+#endif
+    default:
+        single ? solveScalar<true>(tracks, nTracks, hits, out, 0, hits.size)
+               : solveScalar<false>(tracks, nTracks, hits, out, 0, hits.size);
+        return;
+    }
+}
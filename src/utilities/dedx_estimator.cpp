@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "dedx_estimator.h"
+
+void RunningStats::add(double x) {
+    count++;
+    if (count == 1) {
+        min = x;
+        max = x;
+    } else {
+        min = std::min(min, x);
+        max = std::max(max, x);
+    }
+    double delta = x - mean;
+    mean += delta / count;
+    m2 += delta * (x - mean);
+}
+
+void RunningStats::merge(const RunningStats &other) {
+    if (other.count == 0) {
+        return;
+    }
+    if (count == 0) {
+        *this = other;
+        return;
+    }
+    // Chan et al. pairwise combination of two Welford accumulators
+    std::uint64_t total = count + other.count;
+    double delta = other.mean - mean;
+    mean += delta * other.count / total;
+    m2 += other.m2 + delta * delta * count * other.count / total;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    count = total;
+}
+
+double RunningStats::rms() const { return std::sqrt(variance()); }
+
+DedxEstimator::DedxEstimator(const DedxEstimatorConfig &config) : config(config) {}
+
+void DedxEstimator::beginTrack(std::int64_t entry, std::uint32_t muonIndex, const MuonKinematics &muon) {
+    record = {};
+    record.entry = entry;
+    record.muonIndex = muonIndex;
+    record.energy = muon.energy;
+    double dx = muon.stop[0] - muon.start[0];
+    double dy = muon.stop[1] - muon.start[1];
+    double dz = muon.stop[2] - muon.start[2];
+    record.trackLength = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+    // Long tracks get wider bins rather than more of them
+    nBins = std::min<std::size_t>(maxBins, std::max(1.0, std::ceil(record.trackLength / config.binWidth)));
+    binWidth = record.trackLength > 0 ? record.trackLength / nBins : config.binWidth;
+    std::fill(binCharge.begin(), binCharge.begin() + nBins, 0.);
+}
+
+void DedxEstimator::addHit(double charge, const double *emissionDistances, std::size_t nCandidates) {
+    std::size_t bins[2];
+    std::size_t nOnTrack = 0;
+    for (std::size_t i = 0; i < nCandidates && i < 2; i++) {
+        double distance = emissionDistances[i];
+        // This also rejects NaN distances
+        if (distance >= 0 && distance < record.trackLength) {
+            bins[nOnTrack++] = std::min<std::size_t>(nBins - 1, distance / binWidth);
+        }
+    }
+    if (!nOnTrack) {
+        return;
+    }
+    for (std::size_t i = 0; i < nOnTrack; i++) {
+        binCharge[bins[i]] += charge / nOnTrack;
+    }
+    record.nHits++;
+    record.totalCharge += charge;
+}
+
+DedxRecord DedxEstimator::endTrack() {
+    // Charge per unit length of every bin that collected any light
+    std::array<double, maxBins> dqdx;
+    RunningStats trackStats;
+    std::size_t nFilled = 0;
+    for (std::size_t bin = 0; bin < nBins; bin++) {
+        if (binCharge[bin] > 0) {
+            dqdx[nFilled] = binCharge[bin] / binWidth;
+            trackStats.add(dqdx[nFilled]);
+            nFilled++;
+        }
+    }
+    record.nBins = nFilled;
+    record.meanDqdx = trackStats.mean;
+    record.rmsDqdx = trackStats.rms();
+
+    // Drop the highest bins, which are dominated by delta rays and showers, and average the rest
+    std::size_t nKept = nFilled - std::size_t(nFilled * config.truncationFraction);
+    if (nKept) {
+        std::nth_element(dqdx.begin(), dqdx.begin() + nKept - 1, dqdx.begin() + nFilled);
+        double sum = 0;
+        for (std::size_t i = 0; i < nKept; i++) {
+            sum += dqdx[i];
+        }
+        record.truncatedMeanDqdx = sum / nKept;
+        run.add(record.truncatedMeanDqdx);
+    } else {
+        record.truncatedMeanDqdx = std::numeric_limits<double>::quiet_NaN();
+    }
+    return record;
+}
+
+void writeDedxRecordHeader(std::ostream &stream) {
+    stream << "entry,muon,energy,trackLength,nHits,totalCharge,nBins,meanDqdx,rmsDqdx,truncatedMeanDqdx\n";
+}
+
+void writeDedxRecord(std::ostream &stream, const DedxRecord &record) {
+    stream << record.entry << ',' << record.muonIndex << ',' << record.energy << ',' << record.trackLength << ','
+           << record.nHits << ',' << record.totalCharge << ',' << record.nBins << ',' << record.meanDqdx << ','
+           << record.rmsDqdx << ',' << record.truncatedMeanDqdx << '\n';
+}
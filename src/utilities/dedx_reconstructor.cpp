@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <limits>
+
+#include "dedx_reconstructor.h"
+
+DedxReconstructor::DedxReconstructor(const PMTGeometry &geometry, const DedxReconstructorConfig &config)
+    : geometry(geometry), config(config), estimator(config.estimator),
+      preselector(geometry, config.preselection, config.solverPath) {}
+
+const SolvedHits &DedxReconstructor::gather(const EventView &event) {
+    solved.inWindow.clear();
+    gatherWindow(event, -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity());
+    return solved;
+}
+
+const SolvedHits &DedxReconstructor::gather(const EventView &event, const MuonKinematics &muon) {
+    if (!config.preselection.enabled) {
+        return gather(event);
+    }
+    MuonTrack track = muonTrack(muon);
+    double length = trackLength(muon);
+    double begin, end;
+    preselector.eventWindow(track, length, begin, end);
+    solved.inWindow.clear();
+    gatherWindow(event, begin, end);
+
+    std::size_t n = solved.size();
+    std::size_t nKept = preselector.selectCone(track, length, solved.x.data(), solved.y.data(), solved.z.data(),
+                                               solved.t.data(), solved.charge.data(), n);
+    solved.x.resize(nKept);
+    solved.y.resize(nKept);
+    solved.z.resize(nKept);
+    solved.t.resize(nKept);
+    solved.charge.resize(nKept);
+    counters.outsideConeWindow += n - nKept;
+    return solved;
+}
+
+const SolvedHits &DedxReconstructor::gather(const EventView &event, const MuonKinematics *muons, std::size_t nMuons) {
+    if (!config.preselection.enabled || nMuons == 0) {
+        return gather(event);
+    }
+    if (nMuons == 1) {
+        return gather(event, muons[0]);
+    }
+
+    // Gather the hits in any of the event windows, then mark the windows of each muon the hits are in
+    std::vector<double> &begins = windowBegins, &ends = windowEnds, &lengths = trackLengths;
+    begins.resize(nMuons);
+    ends.resize(nMuons);
+    lengths.resize(nMuons);
+    double begin = std::numeric_limits<double>::infinity();
+    double end = -std::numeric_limits<double>::infinity();
+    for (std::size_t muon = 0; muon < nMuons; muon++) {
+        lengths[muon] = trackLength(muons[muon]);
+        preselector.eventWindow(muonTrack(muons[muon]), lengths[muon], begins[muon], ends[muon]);
+        begin = std::min(begin, begins[muon]);
+        end = std::max(end, ends[muon]);
+    }
+    gatherWindow(event, begin, end);
+
+    std::size_t n = solved.size();
+    solved.inWindow.resize(nMuons * n);
+    for (std::size_t muon = 0; muon < nMuons; muon++) {
+        std::uint8_t *inWindow = solved.inWindow.data() + muon * n;
+        preselector.coneMask(muonTrack(muons[muon]), lengths[muon], solved.x.data(), solved.y.data(),
+                             solved.z.data(), solved.t.data(), inWindow, n);
+        // The muon's own event window, so that each muon keeps exactly the hits it would keep on its own
+        for (std::size_t hit = 0; hit < n; hit++) {
+            inWindow[hit] &= (solved.t[hit] >= begins[muon]) & (solved.t[hit] <= ends[muon]);
+        }
+    }
+
+    // Drop the hits that are in no muon's window, compacting the marks along with the hits
+    std::size_t nKept = 0;
+    for (std::size_t hit = 0; hit < n; hit++) {
+        std::uint8_t any = 0;
+        for (std::size_t muon = 0; muon < nMuons; muon++) {
+            any |= solved.inWindow[muon * n + hit];
+        }
+        solved.x[nKept] = solved.x[hit];
+        solved.y[nKept] = solved.y[hit];
+        solved.z[nKept] = solved.z[hit];
+        solved.t[nKept] = solved.t[hit];
+        solved.charge[nKept] = solved.charge[hit];
+        for (std::size_t muon = 0; muon < nMuons; muon++) {
+            solved.inWindow[muon * n + nKept] = solved.inWindow[muon * n + hit];
+        }
+        nKept += any;
+    }
+    for (std::size_t muon = 1; muon < nMuons; muon++) {
+        std::copy_n(solved.inWindow.data() + muon * n, nKept, solved.inWindow.data() + muon * nKept);
+    }
+    solved.x.resize(nKept);
+    solved.y.resize(nKept);
+    solved.z.resize(nKept);
+    solved.t.resize(nKept);
+    solved.charge.resize(nKept);
+    solved.inWindow.resize(nMuons * nKept);
+    counters.outsideConeWindow += n - nKept;
+    return solved;
+}
+
+void DedxReconstructor::gatherWindow(const EventView &event, double begin, double end) {
+    solved.x.clear();
+    solved.y.clear();
+    solved.z.clear();
+    solved.t.clear();
+    solved.charge.clear();
+    for (std::size_t hit = 0; hit < event.nHits; hit++) {
+        int tubeNumber = event.tubeId[hit];
+        if (!geometry.contains(tubeNumber)) {
+            continue;
+        }
+        counters.nHits++;
+        double time = event.time[hit];
+        if (time < begin || time > end) {
+            counters.outsideEventWindow++;
+            continue;
+        }
+        std::size_t row = PMTGeometry::index(tubeNumber);
+        solved.x.push_back(geometry.x[row]);
+        solved.y.push_back(geometry.y[row]);
+        solved.z.push_back(geometry.z[row]);
+        solved.t.push_back(time);
+        solved.charge.push_back(event.charge[hit]);
+    }
+}
+
+const SolvedHits &DedxReconstructor::solve(const MuonTrack &track) {
+    tracks.assign(1, track);
+    return solveTracks(1);
+}
+
+const SolvedHits &DedxReconstructor::solve(const MuonKinematics *muons, std::size_t nMuons) {
+    tracks.resize(nMuons);
+    for (std::size_t muon = 0; muon < nMuons; muon++) {
+        tracks[muon] = muonTrack(muons[muon]);
+    }
+    return solveTracks(nMuons);
+}
+
+const SolvedHits &DedxReconstructor::solveTracks(std::size_t nTracks) {
+    std::size_t n = solved.size();
+    solved.nTracks = nTracks;
+    solved.rootPlus.resize(nTracks * n);
+    solved.rootMinus.resize(nTracks * n);
+    solved.nRoots.resize(nTracks * n);
+    solved.discriminant.resize(config.keepDiscriminants ? nTracks * n : 0);
+    outputs.resize(nTracks);
+    for (std::size_t track = 0; track < nTracks; track++) {
+        outputs[track] = {solved.rootPlus.data() + track * n, solved.rootMinus.data() + track * n,
+                          solved.nRoots.data() + track * n,
+                          config.keepDiscriminants ? solved.discriminant.data() + track * n : nullptr};
+    }
+    HitBatch batch = {solved.x.data(), solved.y.data(), solved.z.data(), solved.t.data(), n};
+    solveEmissionPoints(tracks.data(), nTracks, batch, outputs.data(), config.solverPath);
+    return solved;
+}
+
+DedxRecord DedxReconstructor::measure(std::int64_t entry, std::uint32_t muonIndex, const MuonKinematics &muon,
+                                      std::size_t track) {
+    estimator.beginTrack(entry, muonIndex, muon);
+    std::size_t offset = track * solved.size();
+    for (std::size_t hit = 0; hit < solved.size(); hit++) {
+        if (!solved.onTrack(track, hit)) {
+            continue;
+        }
+        double emissionDistances[2] = {solved.rootPlus[offset + hit], solved.rootMinus[offset + hit]};
+        estimator.addHit(solved.charge[hit], emissionDistances, solved.nRoots[offset + hit]);
+    }
+    return estimator.endTrack();
+}
+
+DedxRecord DedxReconstructor::reconstruct(const EventView &event, std::size_t muonIndex) {
+    const MuonKinematics &muon = event.muons[muonIndex];
+    gather(event, muon);
+    solve(muonTrack(muon));
+    return measure(event.entry, muonIndex, muon);
+}
+
+std::size_t DedxReconstructor::reconstruct(const EventView &event, std::vector<DedxRecord> &records) {
+    if (!event.nMuons) {
+        return 0;
+    }
+    gather(event, event.muons, event.nMuons);
+    solve(event.muons, event.nMuons);
+    for (std::size_t muonIndex = 0; muonIndex < event.nMuons; muonIndex++) {
+        records.push_back(measure(event.entry, muonIndex, event.muons[muonIndex], muonIndex));
+    }
+    return event.nMuons;
+}
+
+std::size_t DedxReconstructor::reconstruct(const EventView *events, std::size_t nEvents,
+                                           std::vector<DedxRecord> &records) {
+    std::size_t nRecords = records.size();
+    for (std::size_t i = 0; i < nEvents; i++) {
+        reconstruct(events[i], records);
+    }
+    return records.size() - nRecords;
+}
+
+MuonTrack muonTrack(const MuonKinematics &muon) {
+    return {{muon.start[0], muon.start[1], muon.start[2]}, {muon.dir[0], muon.dir[1], muon.dir[2]}, muon.time};
+}
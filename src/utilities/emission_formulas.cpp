@@ -0,0 +1,109 @@
+#include <cmath>
+
+#include "emission_formulas.h"
+#include "logger.h"
+
+namespace {
+
+// Compile time sine and cosine for the constants of the fast path, from their Taylor series. The terms fall off
+// fast enough for angles below pi / 2 that 20 of them are exact to double precision.
+constexpr double taylorSin(double x) {
+    double term = x, sum = x;
+    for (int n = 1; n < 20; n++) {
+        term *= -x * x / ((2 * n) * (2 * n + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double taylorCos(double x) {
+    double term = 1, sum = 1;
+    for (int n = 1; n < 20; n++) {
+        term *= -x * x / ((2 * n - 1) * (2 * n));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double cherenkovAngle = 42 * pi / 180;
+constexpr double cotCherenkov = taylorCos(cherenkovAngle) / taylorSin(cherenkovAngle);
+constexpr double ngOverSinCherenkov = ng / taylorSin(cherenkovAngle);
+
+// sin theta of the angle between the muon direction, a unit vector, and the vector to the hit
+double sinAngleToHit(const double muonToHit[3], const double muonDir[3]) {
+    double magnitudeR2 = muonToHit[0] * muonToHit[0] + muonToHit[1] * muonToHit[1] + muonToHit[2] * muonToHit[2];
+    double dotProduct = muonToHit[0] * muonDir[0] + muonToHit[1] * muonDir[1] + muonToHit[2] * muonDir[2];
+    return std::sqrt(std::fmax(0., 1 - dotProduct * dotProduct / magnitudeR2));
+}
+
+} // namespace
+
+// Returns the roots of the quadratic equation ax^2 + bx + c = 0 if they exist
+std::vector<double> quadraticFormula(double a, double b, double c) {
+    double discriminant = getDiscriminant(a, b, c);
+    std::vector<double> roots;
+    if (discriminant < 0) {
+        return roots;
+    } else if (discriminant == 0) {
+        roots.push_back(-b / (2 * a));
+        return roots;
+    } else {
+        // std::cout << "Discriminant: " << discriminant << std::endl;
+        // std::cout << "Upper fraction + : " << (-b + std::sqrt(discriminant)) << std::endl;
+        // std::cout << "Upper fraction - : " << (-b - std::sqrt(discriminant)) << std::endl;
+        // std::cout << "Lower fraction: " << (2 * a) << std::endl;
+
+        roots.push_back((-b + std::sqrt(discriminant)) / (2 * a));
+        roots.push_back((-b - std::sqrt(discriminant)) / (2 * a));
+        return roots;
+    }
+}
+
+// Returns the discriminant of the quadratic equation ax^2 + bx + c = 0
+double getDiscriminant(double a, double b, double c) { return std::pow(b, 2) - 4 * a * c; }
+
+double calculateA() {
+    double a = (1 / std::pow(ng, 2)) - 1;
+    // std::cout << "A is: " << a << std::endl;
+    return a;
+}
+
+double calculateB(double muonToHit[3], double muonEntry[3], double hitTime, double muonEntryTime) {
+    double dotProduct = muonToHit[0] * muonEntry[0] + muonToHit[1] * muonEntry[1] + muonToHit[2] * muonEntry[2];
+    double b = 2 * (dotProduct - (cVac * (hitTime - muonEntryTime)) / std::pow(ng, 2));
+    // std::cout << "B is: " << b << std::endl;
+    return b;
+}
+
+double calculateC(double magnitudeR, double hitTime, double muonEntryTime) {
+    LOG_TRACE("magnitudeR: " << magnitudeR);
+    double c =
+        ((std::pow(cVac, 2) * std::pow((hitTime - muonEntryTime), 2)) / std::pow(ng, 2)) - std::pow(magnitudeR, 2);
+    // std::cout << "C is: " << c << std::endl;
+    return c;
+}
+
+const char *formulaPathName(FormulaPath path) { return path == FormulaPath::Fast ? "fast" : "exact"; }
+
+double calculateZ(double longDist, double muonToHit[3], double muonDir[3], FormulaPath path) {
+    if (path == FormulaPath::Fast) {
+        return longDist + 34000 * sinAngleToHit(muonToHit, muonDir) * cotCherenkov;
+    }
+    double magnitudeR =
+        std::sqrt(std::pow(muonToHit[0], 2) + std::pow(muonToHit[1], 2) + std::pow(muonToHit[2], 2));
+    double dotProduct = muonToHit[0] * muonDir[0] + muonToHit[1] * muonDir[1] + muonToHit[2] * muonDir[2];
+    double z = longDist + 34000 * std::sin(std::acos(dotProduct / magnitudeR)) * (1 / std::tan(42 * pi / 180));
+    return z;
+}
+
+double calculateT(double longDist, double muonToHit[3], double muonDir[3], FormulaPath path) {
+    if (path == FormulaPath::Fast) {
+        return (1 / cVac) * (longDist + 34000 * sinAngleToHit(muonToHit, muonDir)) * ngOverSinCherenkov;
+    }
+    double magnitudeR =
+        std::sqrt(std::pow(muonToHit[0], 2) + std::pow(muonToHit[1], 2) + std::pow(muonToHit[2], 2));
+    double dotProduct = muonToHit[0] * muonDir[0] + muonToHit[1] * muonDir[1] + muonToHit[2] * muonDir[2];
+    double t = (1 / cVac) * (longDist + 34000 * std::sin(std::acos(dotProduct / magnitudeR))) *
+               (ng / std::sin(42 * pi / 180));
+    return t;
+}
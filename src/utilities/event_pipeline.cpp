@@ -0,0 +1,53 @@
+#include "event_pipeline.h"
+
+EventPipeline::EventPipeline(std::size_t nSlots, std::size_t nSolvers)
+    : slots(nSlots ? nSlots : 1), freeSlots(slots.size()), toSolve(slots.size()), solved(slots.size()),
+      activeSolvers(nSolvers), reorder(slots.size(), nullptr) {
+    for (PipelineSlot &slot : slots) {
+        freeSlots.push(&slot);
+    }
+}
+
+PipelineSlot *EventPipeline::acquire() {
+    PipelineSlot *slot = nullptr;
+    freeSlots.pop(slot);
+    slot->sequence = nextToRead++;
+    slot->event.clear();
+    slot->records.clear();
+    return slot;
+}
+
+void EventPipeline::submit(PipelineSlot *slot) { toSolve.push(slot); }
+
+void EventPipeline::finishReading() { toSolve.close(); }
+
+PipelineSlot *EventPipeline::take() {
+    PipelineSlot *slot = nullptr;
+    return toSolve.pop(slot) ? slot : nullptr;
+}
+
+void EventPipeline::complete(PipelineSlot *slot) { solved.push(slot); }
+
+void EventPipeline::finishSolving() {
+    if (activeSolvers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        solved.close();
+    }
+}
+
+PipelineSlot *EventPipeline::next() {
+    // At most slots.size() events are in flight, so every one of them has its own place in the reorder buffer
+    std::size_t place = nextInOrder % slots.size();
+    PipelineSlot *slot = nullptr;
+    while (!reorder[place]) {
+        if (!solved.pop(slot)) {
+            return nullptr;
+        }
+        reorder[slot->sequence % slots.size()] = slot;
+    }
+    slot = reorder[place];
+    reorder[place] = nullptr;
+    nextInOrder++;
+    return slot;
+}
+
+void EventPipeline::release(PipelineSlot *slot) { freeSlots.push(slot); }
@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DEDX_PRESELECTION_X86 1
+#include <immintrin.h>
+#endif
+
+#include "hit_preselection.h"
+
+// The vectorised and scalar windows must agree hit for hit, see the note on FMA contraction in cherenkov_solver.cpp
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+
+namespace {
+
+constexpr double coneSlope2 = ng * ng - 1; // tan^2 of the Cherenkov angle
+constexpr double ng2 = ng * ng;
+
+// The track and margins of one selection, in the form the window tests use
+struct ConeWindow {
+    double t0;
+    double marginLength; // cm, distance light travels in a vacuum during the margin
+    double entry[3];
+    double dir[3];
+    double stop[3];
+    double length;
+};
+
+// Tests the hits [begin, end) one at a time, the fallback for CPUs without AVX2 and the tail of the vectorised path
+void coneMaskScalar(const ConeWindow &window, const double *x, const double *y, const double *z, const double *t,
+                    std::uint8_t *keep, std::size_t begin, std::size_t end) {
+    for (std::size_t hit = begin; hit < end; hit++) {
+        double rx = x[hit] - window.entry[0];
+        double ry = y[hit] - window.entry[1];
+        double rz = z[hit] - window.entry[2];
+        double along = rx * window.dir[0] + ry * window.dir[1] + rz * window.dir[2];
+        double r2 = rx * rx + ry * ry + rz * rz;
+        double rho2 = r2 - along * along;
+        double light = cVac * (t[hit] - window.t0); // Distance light travels in a vacuum between t0 and the hit
+
+        // Not before the cone time: light + margin - along >= rho sqrt(ng^2 - 1)
+        double early = light + window.marginLength - along;
+        bool afterCone = (early >= 0) & (early * early >= coneSlope2 * rho2);
+        // Not after light from the entry point: light - margin <= ng |r|
+        double late = light - window.marginLength;
+        bool beforeEntryLight = (late <= 0) | (late * late <= ng2 * r2);
+        // or not after light from the end of the track: light - margin - L <= ng |x - stop|
+        double sx = x[hit] - window.stop[0];
+        double sy = y[hit] - window.stop[1];
+        double sz = z[hit] - window.stop[2];
+        double lateStop = late - window.length;
+        bool beforeStopLight = (lateStop <= 0) | (lateStop * lateStop <= ng2 * (sx * sx + sy * sy + sz * sz));
+        keep[hit] = afterCone & (beforeEntryLight | beforeStopLight);
+    }
+}
+
+#ifdef DEDX_PRESELECTION_X86
+
+// The same tests as coneMaskScalar four hits at a time. Returns the number of hits tested, the caller finishes the
+// rest with the scalar path.
+__attribute__((target("avx2"))) std::size_t coneMaskAVX2(const ConeWindow &window, const double *x, const double *y,
+                                                          const double *z, const double *t, std::uint8_t *keep,
+                                                          std::size_t nHits) {
+    const __m256d entryX = _mm256_set1_pd(window.entry[0]);
+    const __m256d entryY = _mm256_set1_pd(window.entry[1]);
+    const __m256d entryZ = _mm256_set1_pd(window.entry[2]);
+    const __m256d dirX = _mm256_set1_pd(window.dir[0]);
+    const __m256d dirY = _mm256_set1_pd(window.dir[1]);
+    const __m256d dirZ = _mm256_set1_pd(window.dir[2]);
+    const __m256d stopX = _mm256_set1_pd(window.stop[0]);
+    const __m256d stopY = _mm256_set1_pd(window.stop[1]);
+    const __m256d stopZ = _mm256_set1_pd(window.stop[2]);
+    const __m256d t0 = _mm256_set1_pd(window.t0);
+    const __m256d marginLength = _mm256_set1_pd(window.marginLength);
+    const __m256d length = _mm256_set1_pd(window.length);
+    const __m256d speed = _mm256_set1_pd(cVac);
+    const __m256d slope2 = _mm256_set1_pd(coneSlope2);
+    const __m256d index2 = _mm256_set1_pd(ng2);
+    const __m256d zero = _mm256_setzero_pd();
+
+    std::size_t hit = 0;
+    for (; hit + 4 <= nHits; hit += 4) {
+        __m256d px = _mm256_loadu_pd(x + hit);
+        __m256d py = _mm256_loadu_pd(y + hit);
+        __m256d pz = _mm256_loadu_pd(z + hit);
+        __m256d rx = _mm256_sub_pd(px, entryX);
+        __m256d ry = _mm256_sub_pd(py, entryY);
+        __m256d rz = _mm256_sub_pd(pz, entryZ);
+        __m256d along =
+            _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(rx, dirX), _mm256_mul_pd(ry, dirY)), _mm256_mul_pd(rz, dirZ));
+        __m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(rx, rx), _mm256_mul_pd(ry, ry)), _mm256_mul_pd(rz, rz));
+        __m256d rho2 = _mm256_sub_pd(r2, _mm256_mul_pd(along, along));
+        __m256d light = _mm256_mul_pd(speed, _mm256_sub_pd(_mm256_loadu_pd(t + hit), t0));
+
+        __m256d early = _mm256_sub_pd(_mm256_add_pd(light, marginLength), along);
+        __m256d afterCone = _mm256_and_pd(
+            _mm256_cmp_pd(early, zero, _CMP_GE_OQ),
+            _mm256_cmp_pd(_mm256_mul_pd(early, early), _mm256_mul_pd(slope2, rho2), _CMP_GE_OQ));
+        __m256d late = _mm256_sub_pd(light, marginLength);
+        __m256d beforeEntryLight =
+            _mm256_or_pd(_mm256_cmp_pd(late, zero, _CMP_LE_OQ),
+                         _mm256_cmp_pd(_mm256_mul_pd(late, late), _mm256_mul_pd(index2, r2), _CMP_LE_OQ));
+        __m256d sx = _mm256_sub_pd(px, stopX);
+        __m256d sy = _mm256_sub_pd(py, stopY);
+        __m256d sz = _mm256_sub_pd(pz, stopZ);
+        __m256d s2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(sx, sx), _mm256_mul_pd(sy, sy)), _mm256_mul_pd(sz, sz));
+        __m256d lateStop = _mm256_sub_pd(late, length);
+        __m256d beforeStopLight =
+            _mm256_or_pd(_mm256_cmp_pd(lateStop, zero, _CMP_LE_OQ),
+                         _mm256_cmp_pd(_mm256_mul_pd(lateStop, lateStop), _mm256_mul_pd(index2, s2), _CMP_LE_OQ));
+        int bits = _mm256_movemask_pd(_mm256_and_pd(afterCone, _mm256_or_pd(beforeEntryLight, beforeStopLight)));
+        for (int lane = 0; lane < 4; lane++) {
+            keep[hit + lane] = (bits >> lane) & 1;
+        }
+    }
+    return hit;
+}
+
+#endif
+
+} // namespace
+
+void PreselectionCounters::merge(const PreselectionCounters &other) {
+    nHits += other.nHits;
+    outsideEventWindow += other.outsideEventWindow;
+    outsideConeWindow += other.outsideConeWindow;
+}
+
+PreselectionCounters PreselectionCounters::since(const PreselectionCounters &earlier) const {
+    PreselectionCounters added;
+    added.nHits = nHits - earlier.nHits;
+    added.outsideEventWindow = outsideEventWindow - earlier.outsideEventWindow;
+    added.outsideConeWindow = outsideConeWindow - earlier.outsideConeWindow;
+    return added;
+}
+
+HitPreselector::HitPreselector(const PMTGeometry &geometry, const PreselectionConfig &config, SolverPath path)
+    : settings(config), path(path) {
+    if (!geometry.size()) {
+        return;
+    }
+    auto [minX, maxX] = std::minmax_element(geometry.x.begin(), geometry.x.end());
+    auto [minY, maxY] = std::minmax_element(geometry.y.begin(), geometry.y.end());
+    auto [minZ, maxZ] = std::minmax_element(geometry.z.begin(), geometry.z.end());
+    double dx = *maxX - *minX;
+    double dy = *maxY - *minY;
+    double dz = *maxZ - *minZ;
+    detectorSpan = std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+void HitPreselector::eventWindow(const MuonTrack &track, double trackLength, double &begin, double &end) const {
+    double t0 = track.time + settings.timeOffset;
+    begin = t0 - settings.margin;
+    end = t0 + (trackLength + ng * detectorSpan) / cVac + settings.margin;
+}
+
+void HitPreselector::coneMask(const MuonTrack &track, double trackLength, const double *x, const double *y,
+                              const double *z, const double *t, std::uint8_t *keepHit, std::size_t nHits) const {
+    ConeWindow window;
+    window.t0 = track.time + settings.timeOffset;
+    window.marginLength = cVac * settings.margin;
+    for (int i = 0; i < 3; i++) {
+        window.entry[i] = track.entry[i];
+        window.dir[i] = track.dir[i];
+        window.stop[i] = track.entry[i] + trackLength * track.dir[i];
+    }
+    window.length = trackLength;
+
+    std::size_t nTested = 0;
+#ifdef DEDX_PRESELECTION_X86
+    // Four hits at a time is already as fast as the solver, so the AVX-512 path uses AVX2 here too
+    if (path != SolverPath::Scalar) {
+        nTested = coneMaskAVX2(window, x, y, z, t, keepHit, nHits);
+    }
+#endif
+    coneMaskScalar(window, x, y, z, t, keepHit, nTested, nHits);
+}
+
+std::size_t HitPreselector::selectCone(const MuonTrack &track, double trackLength, double *x, double *y, double *z,
+                                       double *t, double *charge, std::size_t nHits) {
+    // Work out which hits to keep in one pass and compact the columns in a second
+    keep.resize(nHits);
+    coneMask(track, trackLength, x, y, z, t, keep.data(), nHits);
+
+    // Always copy and only advance over the kept hits, so that the loop has no data dependent branches
+    std::size_t nKept = 0;
+    for (std::size_t hit = 0; hit < nHits; hit++) {
+        x[nKept] = x[hit];
+        y[nKept] = y[hit];
+        z[nKept] = z[hit];
+        t[nKept] = t[hit];
+        charge[nKept] = charge[hit];
+        nKept += keep[hit];
+    }
+    return nKept;
+}
+
+double trackLength(const MuonKinematics &muon) {
+    double dx = muon.stop[0] - muon.start[0];
+    double dy = muon.stop[1] - muon.start[1];
+    double dz = muon.stop[2] - muon.start[2];
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
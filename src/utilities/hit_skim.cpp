@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hit_skim.h"
+#include "logger.h"
+
+namespace {
+
+constexpr char skimMagic[8] = {'D', 'E', 'D', 'X', 'S', 'K', 'I', 'M'};
+// Version 2 keeps the hit times in double, version 1 rounded them to float
+constexpr std::uint32_t skimVersion = 2;
+constexpr std::size_t skimAlignment = 64;
+
+struct SkimFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t headerBytes;
+    std::uint64_t nEvents;
+    std::uint64_t nClusters;
+    std::uint64_t geometryKey; // 0 in the files written before it was recorded
+    char padding[24];
+};
+static_assert(sizeof(SkimFileHeader) == skimAlignment, "the skim header must fill one alignment block");
+
+struct SkimClusterHeader {
+    std::uint64_t clusterBytes; // Including this header
+    std::uint32_t nEvents;
+    std::uint32_t nMuons;
+    std::uint32_t nHits;
+    char padding[44];
+};
+static_assert(sizeof(SkimClusterHeader) == skimAlignment, "the cluster header must fill one alignment block");
+
+std::size_t padded(std::size_t bytes) { return (bytes + skimAlignment - 1) / skimAlignment * skimAlignment; }
+
+template <class T> void writeSection(std::ofstream &file, const std::vector<T> &column) {
+    static const char zeros[skimAlignment] = {};
+    std::size_t bytes = column.size() * sizeof(T);
+    file.write(reinterpret_cast<const char *>(column.data()), bytes);
+    file.write(zeros, padded(bytes) - bytes);
+}
+
+} // namespace
+
+SkimWriter::SkimWriter(std::size_t hitsPerCluster) : hitsPerCluster(hitsPerCluster) {}
+
+SkimWriter::~SkimWriter() {
+    if (file.is_open()) {
+        close();
+    }
+}
+
+bool SkimWriter::open(const std::string &path, std::uint64_t geometryKey) {
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    this->geometryKey = geometryKey;
+    nEvents = 0;
+    nClusters = 0;
+    // Reserve the space for the header, it is filled in once the number of events is known
+    SkimFileHeader header = {};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    return bool(file);
+}
+
+void SkimWriter::addEvent(const EventView &event) {
+    SkimEventRecord record;
+    record.entry = event.entry;
+    record.firstMuon = muons.size();
+    record.nMuons = event.nMuons;
+    record.firstHit = tubeId.size();
+    record.nHits = event.nHits;
+    events.push_back(record);
+    muons.insert(muons.end(), event.muons, event.muons + event.nMuons);
+    tubeId.insert(tubeId.end(), event.tubeId, event.tubeId + event.nHits);
+    time.insert(time.end(), event.time, event.time + event.nHits);
+    charge.insert(charge.end(), event.charge, event.charge + event.nHits);
+    nEvents++;
+    if (tubeId.size() >= hitsPerCluster) {
+        flushCluster();
+    }
+}
+
+void SkimWriter::flushCluster() {
+    if (events.empty()) {
+        return;
+    }
+    SkimClusterHeader header = {};
+    header.nEvents = events.size();
+    header.nMuons = muons.size();
+    header.nHits = tubeId.size();
+    header.clusterBytes = sizeof(header) + padded(events.size() * sizeof(SkimEventRecord)) +
+                          padded(muons.size() * sizeof(MuonKinematics)) +
+                          padded(tubeId.size() * sizeof(std::int32_t)) + padded(time.size() * sizeof(double)) +
+                          padded(charge.size() * sizeof(float));
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writeSection(file, events);
+    writeSection(file, muons);
+    writeSection(file, tubeId);
+    writeSection(file, time);
+    writeSection(file, charge);
+    nClusters++;
+    events.clear();
+    muons.clear();
+    tubeId.clear();
+    time.clear();
+    charge.clear();
+}
+
+bool SkimWriter::close() {
+    flushCluster();
+    SkimFileHeader header = {};
+    std::memcpy(header.magic, skimMagic, sizeof(skimMagic));
+    header.version = skimVersion;
+    header.headerBytes = sizeof(header);
+    header.nEvents = nEvents;
+    header.nClusters = nClusters;
+    header.geometryKey = geometryKey;
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    bool ok = bool(file);
+    file.close();
+    return ok;
+}
+
+SkimReader::~SkimReader() { close(); }
+
+bool SkimReader::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || std::size_t(status.st_size) < sizeof(SkimFileHeader)) {
+        ::close(fd);
+        return false;
+    }
+    length = status.st_size;
+    void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        length = 0;
+        return false;
+    }
+    data = static_cast<const char *>(mapping);
+
+    const SkimFileHeader *header = reinterpret_cast<const SkimFileHeader *>(data);
+    if (std::memcmp(header->magic, skimMagic, sizeof(skimMagic)) != 0 || header->version != skimVersion) {
+        if (header->version != skimVersion) {
+            LOG_ERROR(path << " is a version " << header->version << " skim file, version " << skimVersion
+                           << " is needed, rerun skim on its WCSim file");
+        }
+        close();
+        return false;
+    }
+
+    sourceGeometryKey = header->geometryKey;
+
+    // The events are handed out without further checks, so every section and every event record is checked to lie
+    // inside the file once here. Sizes are compared against what is left of the file rather than added to the
+    // offsets, so that corrupt sizes cannot overflow.
+    auto corrupt = [&](const std::string &reason) {
+        LOG_ERROR(path << " is not a valid skim file, " << reason);
+        close();
+        return false;
+    };
+    if (header->headerBytes < sizeof(SkimFileHeader) || header->headerBytes > length) {
+        return corrupt("its header size is out of range");
+    }
+
+    // Walk the clusters once to find where each of their sections starts
+    std::size_t offset = header->headerBytes;
+    for (std::uint64_t i = 0; i < header->nClusters; i++) {
+        if (sizeof(SkimClusterHeader) > length - offset) {
+            return corrupt("cluster " + std::to_string(i) + " starts past the end of the file");
+        }
+        const SkimClusterHeader *clusterHeader = reinterpret_cast<const SkimClusterHeader *>(data + offset);
+        std::uint64_t eventsBytes = padded(std::uint64_t(clusterHeader->nEvents) * sizeof(SkimEventRecord));
+        std::uint64_t muonsBytes = padded(std::uint64_t(clusterHeader->nMuons) * sizeof(MuonKinematics));
+        std::uint64_t tubeIdBytes = padded(std::uint64_t(clusterHeader->nHits) * sizeof(std::int32_t));
+        std::uint64_t timeBytes = padded(std::uint64_t(clusterHeader->nHits) * sizeof(double));
+        std::uint64_t chargeBytes = padded(std::uint64_t(clusterHeader->nHits) * sizeof(float));
+        if (clusterHeader->clusterBytes > length - offset ||
+            clusterHeader->clusterBytes <
+                sizeof(SkimClusterHeader) + eventsBytes + muonsBytes + tubeIdBytes + timeBytes + chargeBytes) {
+            return corrupt("the sections of cluster " + std::to_string(i) + " do not fit inside it");
+        }
+        Cluster cluster;
+        cluster.firstEvent = nEvents;
+        const char *section = data + offset + sizeof(SkimClusterHeader);
+        cluster.events = reinterpret_cast<const SkimEventRecord *>(section);
+        section += eventsBytes;
+        cluster.muons = reinterpret_cast<const MuonKinematics *>(section);
+        section += muonsBytes;
+        cluster.tubeId = reinterpret_cast<const std::int32_t *>(section);
+        section += tubeIdBytes;
+        cluster.time = reinterpret_cast<const double *>(section);
+        section += timeBytes;
+        cluster.charge = reinterpret_cast<const float *>(section);
+        for (std::uint32_t event = 0; event < clusterHeader->nEvents; event++) {
+            const SkimEventRecord &record = cluster.events[event];
+            if (std::uint64_t(record.firstMuon) + record.nMuons > clusterHeader->nMuons ||
+                std::uint64_t(record.firstHit) + record.nHits > clusterHeader->nHits) {
+                return corrupt("event " + std::to_string(nEvents + event) + " reaches past the muons or hits of" +
+                               " cluster " + std::to_string(i));
+            }
+        }
+        clusters.push_back(cluster);
+        nEvents += clusterHeader->nEvents;
+        offset += clusterHeader->clusterBytes;
+    }
+    if (nEvents != header->nEvents) {
+        return corrupt("it holds " + std::to_string(nEvents) + " events where its header says " +
+                       std::to_string(header->nEvents));
+    }
+    return true;
+}
+
+void SkimReader::close() {
+    if (data) {
+        munmap(const_cast<char *>(data), length);
+    }
+    data = nullptr;
+    length = 0;
+    nEvents = 0;
+    sourceGeometryKey = 0;
+    clusters.clear();
+}
+
+EventView SkimReader::event(std::size_t index) const {
+    // Find the last cluster that starts at or before the event
+    auto it = std::upper_bound(clusters.begin(), clusters.end(), index,
+                               [](std::size_t value, const Cluster &cluster) { return value < cluster.firstEvent; });
+    const Cluster &cluster = *(it - 1);
+    const SkimEventRecord &record = cluster.events[index - cluster.firstEvent];
+    return {record.entry,
+            cluster.muons + record.firstMuon,
+            record.nMuons,
+            cluster.tubeId + record.firstHit,
+            cluster.time + record.firstHit,
+            cluster.charge + record.firstHit,
+            record.nHits};
+}
+
+bool isSkimFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(skimMagic)] = {};
+    file.read(magic, sizeof(magic));
+    return file && std::memcmp(magic, skimMagic, sizeof(skimMagic)) == 0;
+}
@@ -0,0 +1,85 @@
+#include <cstdlib>
+#include <fstream>
+
+#include <glob.h>
+
+#include "job_inputs.h"
+#include "logger.h"
+
+namespace {
+
+bool expandPattern(const std::string &pattern, std::vector<std::string> &files) {
+    if (pattern.find_first_of("*?[") == std::string::npos) {
+        files.push_back(pattern);
+        return true;
+    }
+    glob_t matches;
+    int status = glob(pattern.c_str(), 0, nullptr, &matches);
+    if (status != 0) {
+        globfree(&matches);
+        LOG_ERROR("No input files match " << pattern);
+        return false;
+    }
+    for (std::size_t i = 0; i < matches.gl_pathc; i++) {
+        files.push_back(matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+    return true;
+}
+
+} // namespace
+
+bool expandInputs(const std::vector<std::string> &arguments, std::vector<std::string> &files) {
+    for (const std::string &argument : arguments) {
+        if (argument.empty() || argument[0] != '@') {
+            if (!expandPattern(argument, files)) {
+                return false;
+            }
+            continue;
+        }
+        std::ifstream list(argument.substr(1));
+        if (!list) {
+            LOG_ERROR("Failed to read the input list " << argument.substr(1));
+            return false;
+        }
+        std::string line;
+        while (std::getline(list, line)) {
+            // Trim surrounding whitespace
+            std::size_t begin = line.find_first_not_of(" \t\r");
+            if (begin == std::string::npos || line[begin] == '#') {
+                continue;
+            }
+            std::size_t end = line.find_last_not_of(" \t\r");
+            if (!expandPattern(line.substr(begin, end - begin + 1), files)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool parseShard(const std::string &spec, ShardSpec &shard) {
+    std::size_t slash = spec.find('/');
+    if (slash == std::string::npos || slash == 0 || slash + 1 == spec.size()) {
+        return false;
+    }
+    char *end = nullptr;
+    long long index = std::strtoll(spec.c_str(), &end, 10);
+    if (end != spec.c_str() + slash) {
+        return false;
+    }
+    long long count = std::strtoll(spec.c_str() + slash + 1, &end, 10);
+    if (*end != '\0' || count < 1 || index < 0 || index >= count) {
+        return false;
+    }
+    shard.index = index;
+    shard.count = count;
+    return true;
+}
+
+void shardRange(const ShardSpec &shard, long long &first, long long &last) {
+    long long size = last - first;
+    long long begin = first + size * shard.index / shard.count;
+    last = first + size * (shard.index + 1) / shard.count;
+    first = begin;
+}
@@ -0,0 +1,88 @@
+#include <atomic>
+#include <iostream>
+#include <mutex>
+
+#include "logger.h"
+
+namespace {
+
+std::atomic<int> runtimeLevel(int(LogLevel::Info));
+// Serialises writes to the shared output streams so that blocks from different threads do not interleave
+std::mutex sinkMutex;
+
+constexpr std::size_t logBufferBytes = 1 << 16;
+
+const char *levelPrefix(LogLevel level) {
+    switch (level) {
+    case LogLevel::Error:
+        return "Error: ";
+    case LogLevel::Warning:
+        return "Warning: ";
+    case LogLevel::Debug:
+        return "[debug] ";
+    case LogLevel::Trace:
+        return "[trace] ";
+    default:
+        return "";
+    }
+}
+
+struct ThreadLogBuffer {
+    std::string buffer;
+
+    ThreadLogBuffer() { buffer.reserve(logBufferBytes); }
+    ~ThreadLogBuffer() { flush(); }
+
+    void flush() {
+        if (buffer.empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(sinkMutex);
+        std::cout.write(buffer.data(), buffer.size());
+        std::cout.flush();
+        buffer.clear();
+    }
+};
+
+ThreadLogBuffer &threadLogBuffer() {
+    thread_local ThreadLogBuffer buffer;
+    return buffer;
+}
+
+} // namespace
+
+void setLogLevel(LogLevel level) { runtimeLevel.store(int(level), std::memory_order_relaxed); }
+
+LogLevel getLogLevel() { return LogLevel(runtimeLevel.load(std::memory_order_relaxed)); }
+
+bool logEnabled(LogLevel level) { return int(level) <= runtimeLevel.load(std::memory_order_relaxed); }
+
+bool parseLogLevel(const std::string &name, LogLevel &level) {
+    const char *names[] = {"error", "warning", "info", "debug", "trace"};
+    for (int i = 0; i < 5; i++) {
+        if (name == names[i]) {
+            level = LogLevel(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void logMessage(LogLevel level, const std::string &message) {
+    ThreadLogBuffer &threadBuffer = threadLogBuffer();
+    if (level <= LogLevel::Info) {
+        threadBuffer.flush();
+        std::lock_guard<std::mutex> lock(sinkMutex);
+        std::ostream &stream = level <= LogLevel::Warning ? std::cerr : std::cout;
+        stream << levelPrefix(level) << message << std::endl;
+        return;
+    }
+    threadBuffer.buffer += levelPrefix(level);
+    threadBuffer.buffer += message;
+    threadBuffer.buffer += '\n';
+    if (threadBuffer.buffer.size() >= logBufferBytes) {
+        threadBuffer.flush();
+    }
+}
+
+void flushLog() { threadLogBuffer().flush(); }
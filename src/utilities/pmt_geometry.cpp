@@ -0,0 +1,97 @@
+#include <cstring>
+#include <fstream>
+
+#include "logger.h"
+#include "pmt_geometry.h"
+
+namespace {
+
+constexpr char geometryMagic[8] = {'D', 'E', 'D', 'X', 'P', 'M', 'T', 'G'};
+// Version 2 adds the source key
+constexpr std::uint32_t geometryVersion = 2;
+
+struct GeometryFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t nPMTs;
+    std::uint64_t sourceKey;
+};
+
+// Six double columns and the cylinder locations
+constexpr std::size_t bytesPerPMT = 6 * sizeof(double) + sizeof(std::int32_t);
+
+template <class T> void writeColumn(std::ofstream &file, const AlignedVector<T> &column) {
+    file.write(reinterpret_cast<const char *>(column.data()), column.size() * sizeof(T));
+}
+
+template <class T> void readColumn(std::ifstream &file, AlignedVector<T> &column) {
+    file.read(reinterpret_cast<char *>(column.data()), column.size() * sizeof(T));
+}
+
+} // namespace
+
+void PMTGeometry::resize(std::size_t nPMTs) {
+    x.assign(nPMTs, 0);
+    y.assign(nPMTs, 0);
+    z.assign(nPMTs, 0);
+    dirX.assign(nPMTs, 0);
+    dirY.assign(nPMTs, 0);
+    dirZ.assign(nPMTs, 0);
+    cylLoc.assign(nPMTs, -1);
+}
+
+bool writePMTGeometry(const PMTGeometry &geometry, const std::string &path, std::uint64_t sourceKey) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    GeometryFileHeader header = {};
+    std::memcpy(header.magic, geometryMagic, sizeof(geometryMagic));
+    header.version = geometryVersion;
+    header.nPMTs = geometry.size();
+    header.sourceKey = sourceKey;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writeColumn(file, geometry.x);
+    writeColumn(file, geometry.y);
+    writeColumn(file, geometry.z);
+    writeColumn(file, geometry.dirX);
+    writeColumn(file, geometry.dirY);
+    writeColumn(file, geometry.dirZ);
+    writeColumn(file, geometry.cylLoc);
+    return bool(file);
+}
+
+bool readPMTGeometry(PMTGeometry &geometry, const std::string &path, std::uint64_t sourceKey) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    std::uint64_t fileBytes = file.tellg();
+    file.seekg(0);
+    GeometryFileHeader header = {};
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, geometryMagic, sizeof(geometryMagic)) != 0 ||
+        header.version != geometryVersion) {
+        LOG_WARNING(path << " is not a version " << geometryVersion << " geometry table");
+        return false;
+    }
+    // The size is checked before anything is allocated, so a truncated or corrupt table is never read past its end
+    if (fileBytes != sizeof(header) + std::uint64_t(header.nPMTs) * bytesPerPMT) {
+        LOG_WARNING(path << " has " << fileBytes << " bytes, which does not fit a table of " << header.nPMTs
+                         << " PMTs");
+        return false;
+    }
+    if (sourceKey != 0 && header.sourceKey != 0 && header.sourceKey != sourceKey) {
+        LOG_WARNING(path << " was built from another geometry than the input's");
+        return false;
+    }
+    geometry.resize(header.nPMTs);
+    readColumn(file, geometry.x);
+    readColumn(file, geometry.y);
+    readColumn(file, geometry.z);
+    readColumn(file, geometry.dirX);
+    readColumn(file, geometry.dirY);
+    readColumn(file, geometry.dirZ);
+    readColumn(file, geometry.cylLoc);
+    return bool(file);
+}
@@ -0,0 +1,238 @@
+#include <cerrno>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+
+#include "TCanvas.h"
+#include "TFile.h"
+#include "TObjString.h"
+#include "TVectorD.h"
+
+#include "fixed_histogram_root.h"
+#include "logger.h"
+#include "partial_result.h"
+
+namespace {
+
+const char *metadataName = "dedxPartial";
+
+template <class T> std::unique_ptr<T> readHistogram(TFile &file, const char *name) {
+    T *histogram = dynamic_cast<T *>(file.Get(name));
+    if (histogram) {
+        // Take it away from the file so that it outlives it
+        histogram->SetDirectory(nullptr);
+    }
+    return std::unique_ptr<T>(histogram);
+}
+
+// Parses the whole of a metadata value as a number, returns false if it is not one
+bool parseValue(const std::string &value, double &number) {
+    char *end = nullptr;
+    errno = 0;
+    number = std::strtod(value.c_str(), &end);
+    return !value.empty() && *end == '\0' && errno == 0;
+}
+
+bool parseValue(const std::string &value, long long &number) {
+    char *end = nullptr;
+    errno = 0;
+    number = std::strtoll(value.c_str(), &end, 10);
+    return !value.empty() && *end == '\0' && errno == 0;
+}
+
+} // namespace
+
+void PartialResult::bookHistograms() {
+    bool addDirectory = TH1::AddDirectoryStatus();
+    TH1::AddDirectory(false);
+    const HitHistograms binning;
+    const auto &time = binning.hitTime.xAxis();
+    const auto &z = binning.hitTimeVsZ.xAxis();
+    const auto &zTime = binning.hitTimeVsZ.yAxis();
+    hitTimeHist = std::make_unique<TH1D>("hitTimeHist", "Hit Time Distribution", binning.hitTime.nBinsX, time.low,
+                                         time.high);
+    hitTimeVsZ = std::make_unique<TH2D>("hitTimeVsZ", "Hit Time vs Z", binning.hitTimeVsZ.nBinsX, z.low, z.high,
+                                        binning.hitTimeVsZ.nBinsY, zTime.low, zTime.high);
+    TH1::AddDirectory(addDirectory);
+}
+
+void PartialResult::add(const HitHistograms &histograms) {
+    addToROOT(histograms.hitTime, *hitTimeHist);
+    addToROOT(histograms.hitTimeVsZ, *hitTimeVsZ);
+}
+
+bool PartialResult::compatible(const PartialResult &other, std::string &reason) const {
+    if (estimatorConfig.binWidth != other.estimatorConfig.binWidth ||
+        estimatorConfig.truncationFraction != other.estimatorConfig.truncationFraction) {
+        reason = "different dE/dx binning or truncation";
+        return false;
+    }
+    if (preselectionConfig.enabled != other.preselectionConfig.enabled ||
+        (preselectionConfig.enabled && (preselectionConfig.margin != other.preselectionConfig.margin ||
+                                        preselectionConfig.timeOffset != other.preselectionConfig.timeOffset))) {
+        reason = "different hit preselection";
+        return false;
+    }
+    if (ng != other.ng || cVac != other.cVac) {
+        reason = "different physics constants";
+        return false;
+    }
+    if (hasDiscriminants != other.hasDiscriminants) {
+        reason = "only one of them has a discriminant summary";
+        return false;
+    }
+    return true;
+}
+
+void PartialResult::merge(const PartialResult &other) {
+    inputs.insert(inputs.end(), other.inputs.begin(), other.inputs.end());
+    nEntries += other.nEntries;
+    // The statistics are computed from the bins, as in addToROOT. The bin contents are integer counts so they do not
+    // depend on how the entries were split, while the sums that TH1::Add adds up would depend on it through
+    // rounding, so they are recomputed.
+    hitTimeHist->Add(other.hitTimeHist.get());
+    hitTimeVsZ->Add(other.hitTimeVsZ.get());
+    resetStats(*hitTimeHist, hitTimeHist->GetEntries());
+    resetStats(*hitTimeVsZ, hitTimeVsZ->GetEntries());
+    dedxStats.merge(other.dedxStats);
+    discriminantCounters.merge(other.discriminantCounters);
+}
+
+bool writePartialResult(const PartialResult &result, const std::string &path) {
+    std::unique_ptr<TFile> file(TFile::Open(path.c_str(), "RECREATE"));
+    if (!file || file->IsZombie()) {
+        LOG_ERROR("Failed to create " << path);
+        return false;
+    }
+
+    // The configuration and the provenance are plain key=value lines so that they can be read by eye
+    std::ostringstream metadata;
+    metadata << std::setprecision(17);
+    metadata << "format=" << metadataName << "\n";
+    metadata << "version=" << PartialResult::formatVersion << "\n";
+    metadata << "binWidth=" << result.estimatorConfig.binWidth << "\n";
+    metadata << "truncationFraction=" << result.estimatorConfig.truncationFraction << "\n";
+    metadata << "preselection=" << result.preselectionConfig.enabled << "\n";
+    metadata << "preselectionMargin=" << result.preselectionConfig.margin << "\n";
+    metadata << "preselectionOffset=" << result.preselectionConfig.timeOffset << "\n";
+    metadata << "ng=" << result.ng << "\n";
+    metadata << "cVac=" << result.cVac << "\n";
+    metadata << "entries=" << result.nEntries << "\n";
+    metadata << "records=" << result.recordsFile << "\n";
+    metadata << "discriminants=" << result.hasDiscriminants << "\n";
+    for (const std::string &input : result.inputs) {
+        metadata << "input=" << input << "\n";
+    }
+    TObjString metadataString(metadata.str().c_str());
+    file->WriteTObject(&metadataString, metadataName);
+
+    TVectorD dedxStats(5);
+    dedxStats[0] = result.dedxStats.count;
+    dedxStats[1] = result.dedxStats.mean;
+    dedxStats[2] = result.dedxStats.m2;
+    dedxStats[3] = result.dedxStats.min;
+    dedxStats[4] = result.dedxStats.max;
+    file->WriteTObject(&dedxStats, "dedxStats");
+    TVectorD discriminants(4);
+    discriminants[0] = result.discriminantCounters.negative;
+    discriminants[1] = result.discriminantCounters.zero;
+    discriminants[2] = result.discriminantCounters.twoRoots;
+    discriminants[3] = result.discriminantCounters.nearZero;
+    file->WriteTObject(&discriminants, "discriminantCounters");
+
+    file->WriteTObject(result.hitTimeHist.get(), "hitTimeHist");
+    file->WriteTObject(result.hitTimeVsZ.get(), "hitTimeVsZ");
+    file->Close();
+    return true;
+}
+
+bool readPartialResult(PartialResult &result, const std::string &path) {
+    std::unique_ptr<TFile> file(TFile::Open(path.c_str(), "READ"));
+    if (!file || file->IsZombie()) {
+        LOG_ERROR("Failed to open " << path);
+        return false;
+    }
+    TObjString *metadataString = dynamic_cast<TObjString *>(file->Get(metadataName));
+    if (!metadataString) {
+        LOG_ERROR(path << " is not a dedx partial result");
+        return false;
+    }
+
+    result = PartialResult();
+    std::istringstream metadata(metadataString->GetString().Data());
+    std::string line;
+    long long version = -1;
+    while (std::getline(metadata, line)) {
+        std::size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            continue;
+        }
+        std::string key = line.substr(0, equals);
+        std::string value = line.substr(equals + 1);
+        long long entries = 0;
+        bool ok = true;
+        if (key == "version") {
+            ok = parseValue(value, version);
+        } else if (key == "binWidth") {
+            ok = parseValue(value, result.estimatorConfig.binWidth);
+        } else if (key == "truncationFraction") {
+            ok = parseValue(value, result.estimatorConfig.truncationFraction);
+        } else if (key == "preselection") {
+            result.preselectionConfig.enabled = value == "1";
+        } else if (key == "preselectionMargin") {
+            ok = parseValue(value, result.preselectionConfig.margin);
+        } else if (key == "preselectionOffset") {
+            ok = parseValue(value, result.preselectionConfig.timeOffset);
+        } else if (key == "ng") {
+            ok = parseValue(value, result.ng);
+        } else if (key == "cVac") {
+            ok = parseValue(value, result.cVac);
+        } else if (key == "entries") {
+            ok = parseValue(value, entries);
+            result.nEntries = entries;
+        } else if (key == "records") {
+            result.recordsFile = value;
+        } else if (key == "discriminants") {
+            result.hasDiscriminants = value == "1";
+        } else if (key == "input") {
+            result.inputs.push_back(value);
+        }
+        if (!ok) {
+            LOG_ERROR(path << " has a malformed " << key << " in its metadata: " << value);
+            return false;
+        }
+    }
+    if (version != PartialResult::formatVersion) {
+        LOG_ERROR(path << " has partial result format version " << version << ", expected "
+                       << PartialResult::formatVersion);
+        return false;
+    }
+
+    TVectorD *dedxStats = dynamic_cast<TVectorD *>(file->Get("dedxStats"));
+    TVectorD *discriminants = dynamic_cast<TVectorD *>(file->Get("discriminantCounters"));
+    result.hitTimeHist = readHistogram<TH1D>(*file, "hitTimeHist");
+    result.hitTimeVsZ = readHistogram<TH2D>(*file, "hitTimeVsZ");
+    if (!dedxStats || !discriminants || !result.hitTimeHist || !result.hitTimeVsZ) {
+        LOG_ERROR(path << " is missing part of the partial result");
+        return false;
+    }
+    result.dedxStats.count = (*dedxStats)[0];
+    result.dedxStats.mean = (*dedxStats)[1];
+    result.dedxStats.m2 = (*dedxStats)[2];
+    result.dedxStats.min = (*dedxStats)[3];
+    result.dedxStats.max = (*dedxStats)[4];
+    result.discriminantCounters.negative = (*discriminants)[0];
+    result.discriminantCounters.zero = (*discriminants)[1];
+    result.discriminantCounters.twoRoots = (*discriminants)[2];
+    result.discriminantCounters.nearZero = (*discriminants)[3];
+    return true;
+}
+
+void drawPartialResult(const PartialResult &result, const std::string &outputBase) {
+    TCanvas canvas("c1", "c1", 800, 600);
+    result.hitTimeHist->Draw();
+    canvas.SaveAs((outputBase + "_hitTimeHist.C").c_str());
+    canvas.Clear();
+    result.hitTimeVsZ->Draw("colz");
+    canvas.SaveAs((outputBase + "_hitTimeVsZ.C").c_str());
+}
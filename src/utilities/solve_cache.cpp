@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <glob.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "physics_constants.h"
+#include "solve_cache.h"
+
+namespace {
+
+constexpr char solveCacheMagic[8] = {'D', 'E', 'D', 'X', 'S', 'O', 'L', 'V'};
+// Raised whenever the solver or the layout of a piece changes, so that older pieces are no longer used
+constexpr std::uint32_t solveCacheVersion = 2;
+// How much of the start and of the end of an input goes into its key
+constexpr std::size_t keySampleBytes = 1 << 20;
+
+struct SolveCacheFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t headerBytes;
+    std::uint64_t nEvents;
+};
+
+struct SolveCacheEventHeader {
+    std::int64_t entry;
+    std::uint64_t nHits;
+    std::uint64_t payloadBytes; // Of the columns that follow the header
+    // What the preselection counted when the hits were gathered
+    std::uint64_t preselectedHits;
+    std::uint64_t outsideEventWindow;
+    std::uint64_t outsideConeWindow;
+    std::uint32_t nMuons;
+    std::uint32_t nTracks;
+    std::uint32_t nRows;
+    std::uint32_t hasWindows;
+};
+
+// 64 bit FNV-1a, enough to tell inputs and configurations apart, it is not meant to resist tampering
+class Hash {
+  public:
+    void add(const void *data, std::size_t bytes) {
+        const unsigned char *byte = static_cast<const unsigned char *>(data);
+        for (std::size_t i = 0; i < bytes; i++) {
+            value = (value ^ byte[i]) * 0x100000001b3ull;
+        }
+    }
+    template <class T> void add(const T &item) { add(&item, sizeof(T)); }
+    template <class T> void addColumn(const AlignedVector<T> &column) { add(column.data(), column.size() * sizeof(T)); }
+    std::uint64_t get() const { return value; }
+
+  private:
+    std::uint64_t value = 0xcbf29ce484222325ull;
+};
+
+template <class T> void writeColumn(std::ofstream &file, const T *column, std::size_t size) {
+    file.write(reinterpret_cast<const char *>(column), size * sizeof(T));
+}
+
+template <class T, class Allocator> void readColumn(std::ifstream &file, std::vector<T, Allocator> &column,
+                                                    std::size_t size) {
+    column.resize(size);
+    file.read(reinterpret_cast<char *>(column.data()), size * sizeof(T));
+}
+
+// Parses <begin>_<end>.solve, the end of the name of a piece
+bool parsePieceRange(const std::string &name, std::int64_t &begin, std::int64_t &end) {
+    long long first = 0, last = 0;
+    int length = 0;
+    if (std::sscanf(name.c_str(), "%lld_%lld.solve%n", &first, &last, &length) != 2 ||
+        std::size_t(length) != name.size()) {
+        return false;
+    }
+    begin = first;
+    end = last;
+    return begin < end;
+}
+
+} // namespace
+
+bool SolveCache::open(const std::string &directory, const PMTGeometry &geometry,
+                      const PreselectionConfig &preselection, bool antiMuons) {
+    struct stat status;
+    if (::mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+        LOG_ERROR("Failed to create the solve cache directory " << directory << ": " << std::strerror(errno));
+        return false;
+    }
+    if (::stat(directory.c_str(), &status) != 0 || !S_ISDIR(status.st_mode)) {
+        LOG_ERROR("The solve cache " << directory << " is not a directory");
+        return false;
+    }
+    this->directory = directory;
+
+    Hash hash;
+    hash.add(solveCacheVersion);
+    hash.add(cVac);
+    hash.add(ng);
+    hash.add(preselection.enabled);
+    if (preselection.enabled) {
+        hash.add(preselection.margin);
+        hash.add(preselection.timeOffset);
+    }
+    hash.add(antiMuons);
+    hash.add(geometry.size());
+    hash.addColumn(geometry.x);
+    hash.addColumn(geometry.y);
+    hash.addColumn(geometry.z);
+    hash.addColumn(geometry.dirX);
+    hash.addColumn(geometry.dirY);
+    hash.addColumn(geometry.dirZ);
+    hash.addColumn(geometry.cylLoc);
+    configHash = hash.get();
+    return true;
+}
+
+std::string SolveCache::key(const std::string &inputPath) const {
+    struct stat status;
+    std::ifstream file(inputPath, std::ios::binary | std::ios::ate);
+    if (!file || ::stat(inputPath.c_str(), &status) != 0) {
+        return "";
+    }
+    std::uint64_t size = file.tellg();
+    Hash hash;
+    hash.add(configHash);
+    hash.add(size);
+    // A rewrite of the file in place keeps its size, and may keep its first and last MiB, but gives it a new
+    // modification time, while a file written anew gets a new inode
+    hash.add(std::uint64_t(status.st_ino));
+    hash.add(std::int64_t(status.st_mtim.tv_sec));
+    hash.add(std::int64_t(status.st_mtim.tv_nsec));
+    std::vector<char> sample(std::min<std::uint64_t>(size, keySampleBytes));
+    file.seekg(0);
+    file.read(sample.data(), sample.size());
+    hash.add(sample.data(), sample.size());
+    if (size > sample.size()) {
+        std::uint64_t tailStart = std::max<std::uint64_t>(sample.size(), size - keySampleBytes);
+        sample.resize(size - tailStart);
+        file.seekg(tailStart);
+        file.read(sample.data(), sample.size());
+        hash.add(sample.data(), sample.size());
+    }
+    if (!file) {
+        return "";
+    }
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash.get()));
+    return key;
+}
+
+bool SolveCache::find(const std::string &key, std::int64_t begin, std::int64_t end,
+                      std::vector<SolveCachePiece> &pieces) const {
+    pieces.clear();
+    if (key.empty()) {
+        return false;
+    }
+    std::string prefix = directory + "/" + key + "_";
+    std::vector<SolveCachePiece> candidates;
+    glob_t matches;
+    if (glob((prefix + "*.solve").c_str(), 0, nullptr, &matches) == 0) {
+        for (std::size_t i = 0; i < matches.gl_pathc; i++) {
+            SolveCachePiece piece;
+            piece.path = matches.gl_pathv[i];
+            if (parsePieceRange(piece.path.substr(prefix.size()), piece.begin, piece.end)) {
+                candidates.push_back(piece);
+            }
+        }
+    }
+    globfree(&matches);
+
+    // Cover the range from the front, each time with the piece that reaches furthest
+    std::int64_t covered = begin;
+    while (covered < end) {
+        const SolveCachePiece *best = nullptr;
+        for (const SolveCachePiece &piece : candidates) {
+            if (piece.begin <= covered && piece.end > covered && (!best || piece.end > best->end)) {
+                best = &piece;
+            }
+        }
+        if (!best) {
+            pieces.clear();
+            return false;
+        }
+        pieces.push_back(*best);
+        covered = best->end;
+    }
+    return true;
+}
+
+std::string SolveCache::piecePath(const std::string &key, std::int64_t begin, std::int64_t end) const {
+    return directory + "/" + key + "_" + std::to_string(begin) + "_" + std::to_string(end) + ".solve";
+}
+
+SolveCacheWriter::~SolveCacheWriter() { discard(); }
+
+bool SolveCacheWriter::open(const std::string &path) {
+    discard();
+    this->path = path;
+    // Unique to the process, in case two jobs write the same piece at once
+    temporaryPath = path + ".tmp" + std::to_string(::getpid());
+    file.open(temporaryPath, std::ios::binary | std::ios::trunc);
+    nEvents = 0;
+    // Reserve the space for the header, it is filled in once the number of events is known
+    SolveCacheFileHeader header = {};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    return bool(file);
+}
+
+void SolveCacheWriter::addEvent(const EventView &event, const SolvedHits &hits,
+                                const PreselectionCounters &preselection) {
+    std::size_t nRows = hits.size();
+    std::size_t nSolutions = hits.nTracks * nRows;
+    bool hasWindows = !hits.inWindow.empty();
+    SolveCacheEventHeader header = {};
+    header.entry = event.entry;
+    header.nHits = event.nHits;
+    header.preselectedHits = preselection.nHits;
+    header.outsideEventWindow = preselection.outsideEventWindow;
+    header.outsideConeWindow = preselection.outsideConeWindow;
+    header.nMuons = event.nMuons;
+    header.nTracks = hits.nTracks;
+    header.nRows = nRows;
+    header.hasWindows = hasWindows;
+    header.payloadBytes = event.nMuons * sizeof(MuonKinematics) + 2 * nRows * sizeof(double) +
+                          2 * nSolutions * sizeof(double) + (hasWindows ? 2 : 1) * nSolutions;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writeColumn(file, event.muons, event.nMuons);
+    writeColumn(file, hits.t.data(), nRows);
+    writeColumn(file, hits.charge.data(), nRows);
+    writeColumn(file, hits.rootPlus.data(), nSolutions);
+    writeColumn(file, hits.rootMinus.data(), nSolutions);
+    writeColumn(file, hits.nRoots.data(), nSolutions);
+    if (hasWindows) {
+        writeColumn(file, hits.inWindow.data(), nSolutions);
+    }
+    nEvents++;
+}
+
+bool SolveCacheWriter::close() {
+    if (!file.is_open()) {
+        return false;
+    }
+    SolveCacheFileHeader header = {};
+    std::memcpy(header.magic, solveCacheMagic, sizeof(solveCacheMagic));
+    header.version = solveCacheVersion;
+    header.headerBytes = sizeof(header);
+    header.nEvents = nEvents;
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    bool ok = bool(file);
+    file.close();
+    if (ok && std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        LOG_WARNING("Failed to write the solve cache piece " << path);
+        std::remove(temporaryPath.c_str());
+    }
+    temporaryPath.clear();
+    return ok;
+}
+
+void SolveCacheWriter::discard() {
+    if (file.is_open()) {
+        file.close();
+    }
+    if (!temporaryPath.empty()) {
+        std::remove(temporaryPath.c_str());
+        temporaryPath.clear();
+    }
+}
+
+bool SolveCacheReader::open(const std::string &path) {
+    file.close();
+    file.clear();
+    file.open(path, std::ios::binary);
+    SolveCacheFileHeader header = {};
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, solveCacheMagic, sizeof(solveCacheMagic)) != 0 ||
+        header.version != solveCacheVersion) {
+        LOG_ERROR("Failed to read the solve cache piece " << path);
+        return false;
+    }
+    file.seekg(header.headerBytes);
+    nEvents = header.nEvents;
+    nRead = 0;
+    return bool(file);
+}
+
+bool SolveCacheReader::next(CachedEvent &event, SolvedHits &hits) {
+    if (nRead == nEvents) {
+        return false;
+    }
+    SolveCacheEventHeader header;
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!file) {
+        return false;
+    }
+    std::size_t nSolutions = std::size_t(header.nTracks) * header.nRows;
+    event.entry = header.entry;
+    event.nHits = header.nHits;
+    event.preselection.nHits = header.preselectedHits;
+    event.preselection.outsideEventWindow = header.outsideEventWindow;
+    event.preselection.outsideConeWindow = header.outsideConeWindow;
+    event.muons.resize(header.nMuons);
+    file.read(reinterpret_cast<char *>(event.muons.data()), header.nMuons * sizeof(MuonKinematics));
+    // Only the columns that were kept are filled, the positions and discriminants are left empty
+    hits.x.clear();
+    hits.y.clear();
+    hits.z.clear();
+    hits.discriminant.clear();
+    hits.nTracks = header.nTracks;
+    readColumn(file, hits.t, header.nRows);
+    readColumn(file, hits.charge, header.nRows);
+    readColumn(file, hits.rootPlus, nSolutions);
+    readColumn(file, hits.rootMinus, nSolutions);
+    readColumn(file, hits.nRoots, nSolutions);
+    readColumn(file, hits.inWindow, header.hasWindows ? nSolutions : 0);
+    nRead++;
+    return bool(file);
+}
+
+bool SolveCacheReader::skip() {
+    if (nRead == nEvents) {
+        return false;
+    }
+    SolveCacheEventHeader header;
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    file.seekg(header.payloadBytes, std::ios::cur);
+    nRead++;
+    return bool(file);
+}
@@ -0,0 +1,174 @@
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DEDX_PROFILE_TSC 1
+#include <x86intrin.h>
+#endif
+
+#include "logger.h"
+#include "stage_profile.h"
+
+namespace {
+
+void writeProfileTextBlock(std::ostream &stream, const StageProfile &profile, double perSecond) {
+    double total = 0;
+    for (std::size_t stage = 0; stage < nStages; stage++) {
+        total += profile.ticks[stage];
+    }
+    total = total > 0 ? total : 1;
+    for (std::size_t stage = 0; stage < nStages; stage++) {
+        if (!profile.calls[stage]) {
+            continue;
+        }
+        double seconds = profile.ticks[stage] / perSecond;
+        stream << "  " << std::left << std::setw(14) << stageName(Stage(stage)) << std::right << std::fixed
+               << std::setprecision(3) << std::setw(12) << seconds << " s" << std::setw(12) << profile.calls[stage]
+               << " calls" << std::setw(12) << seconds / profile.calls[stage] * 1e6 << " us/call"
+               << std::setprecision(1) << std::setw(8) << 100 * profile.ticks[stage] / total << " %" << std::endl;
+    }
+}
+
+void writeProfileJSONObject(std::ostream &stream, const StageProfile &profile, double perSecond) {
+    stream << "{\"events\": " << profile.events << ", \"hits\": " << profile.hits
+           << ", \"rejectedHits\": " << profile.rejectedHits << ", \"solvedHits\": " << profile.solvedHits
+           << ", \"validRoots\": " << profile.validRoots << ", \"stages\": {";
+    bool first = true;
+    for (std::size_t stage = 0; stage < nStages; stage++) {
+        if (!profile.calls[stage]) {
+            continue;
+        }
+        stream << (first ? "" : ", ") << "\"" << stageName(Stage(stage))
+               << "\": {\"seconds\": " << profile.ticks[stage] / perSecond << ", \"calls\": " << profile.calls[stage]
+               << "}";
+        first = false;
+    }
+    stream << "}}";
+}
+
+StageProfile sum(const std::vector<StageProfile> &profiles) {
+    StageProfile total;
+    for (const StageProfile &profile : profiles) {
+        total.merge(profile);
+    }
+    return total;
+}
+
+} // namespace
+
+const char *stageName(Stage stage) {
+    switch (stage) {
+    case Stage::FileOpen:
+        return "fileOpen";
+    case Stage::GeometryLoad:
+        return "geometryLoad";
+    case Stage::ReadEntry:
+        return "readEntry";
+    case Stage::Decode:
+        return "decode";
+    case Stage::Gather:
+        return "gather";
+    case Stage::Solve:
+        return "solve";
+    case Stage::Fill:
+        return "fill";
+    case Stage::Measure:
+        return "measure";
+    default:
+        return "output";
+    }
+}
+
+std::uint64_t readTicks() {
+#ifdef DEDX_PROFILE_TSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+double ticksPerSecond() {
+#ifdef DEDX_PROFILE_TSC
+    // The counter runs at a constant rate on every CPU of the last decade, so measuring it once is enough
+    static const double rate = []() {
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point start = Clock::now();
+        std::uint64_t startTicks = __rdtsc();
+        double elapsed = 0;
+        do {
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        } while (elapsed < 0.02);
+        return (__rdtsc() - startTicks) / elapsed;
+    }();
+    return rate;
+#else
+    return 1e9;
+#endif
+}
+
+void StageProfile::merge(const StageProfile &other) {
+    for (std::size_t stage = 0; stage < nStages; stage++) {
+        ticks[stage] += other.ticks[stage];
+        calls[stage] += other.calls[stage];
+    }
+    events += other.events;
+    hits += other.hits;
+    rejectedHits += other.rejectedHits;
+    solvedHits += other.solvedHits;
+    validRoots += other.validRoots;
+}
+
+void writeProfileText(std::ostream &stream, const std::vector<StageProfile> &profiles,
+                      const std::vector<std::string> &threadNames, double wallSeconds) {
+    double perSecond = ticksPerSecond();
+    StageProfile total = sum(profiles);
+    wallSeconds = wallSeconds > 0 ? wallSeconds : 1e-9;
+    stream << std::fixed << std::setprecision(3) << "Run of " << wallSeconds << " s on " << profiles.size()
+           << " thread(s): " << total.events << " events, " << std::setprecision(1) << total.events / wallSeconds
+           << " events/s, " << total.hits << " hits, " << total.hits / wallSeconds << " hits/s" << std::endl;
+    stream << total.rejectedHits << " hits rejected by the preselection, " << total.solvedHits << " solved, "
+           << total.validRoots << " with real roots" << std::endl;
+    stream << "All threads" << std::endl;
+    writeProfileTextBlock(stream, total, perSecond);
+    for (std::size_t thread = 0; thread < profiles.size(); thread++) {
+        stream << threadNames[thread] << ": " << profiles[thread].events << " events, " << profiles[thread].hits
+               << " hits" << std::endl;
+        writeProfileTextBlock(stream, profiles[thread], perSecond);
+    }
+}
+
+void writeProfileJSON(std::ostream &stream, const std::vector<StageProfile> &profiles,
+                      const std::vector<std::string> &threadNames, double wallSeconds) {
+    double perSecond = ticksPerSecond();
+    StageProfile total = sum(profiles);
+    wallSeconds = wallSeconds > 0 ? wallSeconds : 1e-9;
+    stream << std::setprecision(9) << "{\"wallSeconds\": " << wallSeconds << ", \"ticksPerSecond\": " << perSecond
+           << ", \"eventsPerSecond\": " << total.events / wallSeconds
+           << ", \"hitsPerSecond\": " << total.hits / wallSeconds << ",\n \"total\": ";
+    writeProfileJSONObject(stream, total, perSecond);
+    stream << ",\n \"threads\": [";
+    for (std::size_t thread = 0; thread < profiles.size(); thread++) {
+        stream << (thread ? ",\n  " : "\n  ") << "{\"name\": \"" << threadNames[thread] << "\", \"profile\": ";
+        writeProfileJSONObject(stream, profiles[thread], perSecond);
+        stream << "}";
+    }
+    stream << "]}" << std::endl;
+}
+
+bool writeProfileReport(const std::string &path, const std::vector<StageProfile> &profiles,
+                        const std::vector<std::string> &threadNames, double wallSeconds) {
+    std::ofstream file(path);
+    bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    if (json) {
+        writeProfileJSON(file, profiles, threadNames, wallSeconds);
+    } else {
+        writeProfileText(file, profiles, threadNames, wallSeconds);
+    }
+    if (!file) {
+        LOG_ERROR("Failed to write the profile report " << path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cmath>
+
+#include "physics_constants.h"
+#include "synthetic_events.h"
+
+namespace {
+
+constexpr double twoPi = 6.283185307179586;
+
+void addPMT(PMTGeometry &geometry, double x, double y, double z, double dirX, double dirY, double dirZ,
+            int cylLoc) {
+    geometry.x.push_back(x);
+    geometry.y.push_back(y);
+    geometry.z.push_back(z);
+    geometry.dirX.push_back(dirX);
+    geometry.dirY.push_back(dirY);
+    geometry.dirZ.push_back(dirZ);
+    geometry.cylLoc.push_back(cylLoc);
+}
+
+// Distance along the unit direction d from the point p, inside the cylinder, to its wall or caps
+double distanceToExit(const double p[3], const double d[3], double radius, double halfHeight) {
+    double exit = INFINITY;
+    // Barrel: |p_xy + s d_xy| = radius
+    double a = d[0] * d[0] + d[1] * d[1];
+    if (a > 0) {
+        double b = p[0] * d[0] + p[1] * d[1];
+        double c = p[0] * p[0] + p[1] * p[1] - radius * radius;
+        exit = (-b + std::sqrt(b * b - a * c)) / a;
+    }
+    // Caps
+    if (d[2] < 0) {
+        exit = std::fmin(exit, (-halfHeight - p[2]) / d[2]);
+    } else if (d[2] > 0) {
+        exit = std::fmin(exit, (halfHeight - p[2]) / d[2]);
+    }
+    return exit;
+}
+
+} // namespace
+
+PMTGeometry makeSyntheticGeometry(const SyntheticDetectorConfig &config) {
+    PMTGeometry geometry;
+    // Top cap, barrel and bottom cap, in the same order as the WCSim cylinder locations
+    int nRings = int(config.radius / config.pmtSpacing);
+    for (int cap = 0; cap < 2; cap++) {
+        double z = cap == 0 ? config.halfHeight : -config.halfHeight;
+        double dirZ = cap == 0 ? -1 : 1;
+        for (int ring = 0; ring < nRings; ring++) {
+            double r = (ring + 0.5) * config.pmtSpacing;
+            int nOnRing = std::max(1, int(twoPi * r / config.pmtSpacing));
+            for (int i = 0; i < nOnRing; i++) {
+                double phi = twoPi * i / nOnRing;
+                addPMT(geometry, r * std::cos(phi), r * std::sin(phi), z, 0, 0, dirZ, cap == 0 ? 0 : 2);
+            }
+        }
+        if (cap == 0) {
+            int nColumns = int(twoPi * config.radius / config.pmtSpacing);
+            int nRows = int(2 * config.halfHeight / config.pmtSpacing);
+            for (int row = 0; row < nRows; row++) {
+                double barrelZ = -config.halfHeight + (row + 0.5) * config.pmtSpacing;
+                for (int column = 0; column < nColumns; column++) {
+                    double phi = twoPi * column / nColumns;
+                    addPMT(geometry, config.radius * std::cos(phi), config.radius * std::sin(phi), barrelZ,
+                           -std::cos(phi), -std::sin(phi), 0, 1);
+                }
+            }
+        }
+    }
+    return geometry;
+}
+
+SyntheticEventGenerator::SyntheticEventGenerator(const PMTGeometry &geometry, const SyntheticDetectorConfig &detector,
+                                                 const SyntheticEventConfig &config, std::uint64_t seed)
+    : geometry(geometry), detector(detector), config(config), random(seed) {}
+
+void SyntheticEventGenerator::generate(std::int64_t entry, FlatEvent &event, SyntheticTruth *truth) {
+    std::uniform_real_distribution<double> uniform(0, 1);
+    event.clear();
+    event.entry = entry;
+    if (truth) {
+        truth->muon.clear();
+        truth->emission.clear();
+    }
+    const double cherenkovAngle = std::acos(1 / ng);
+
+    // Several muons of a bundle all arrive at the same time
+    for (int muonN = 0; muonN < config.muonsPerEvent; muonN++) {
+        // Enter uniformly over the top cap, heading downwards
+        MuonKinematics muon;
+        double r = 0.9 * detector.radius * std::sqrt(uniform(random));
+        double phi = twoPi * uniform(random);
+        muon.start[0] = r * std::cos(phi);
+        muon.start[1] = r * std::sin(phi);
+        muon.start[2] = detector.halfHeight;
+        double zenith = config.maxZenith * uniform(random);
+        double azimuth = twoPi * uniform(random);
+        muon.dir[0] = std::sin(zenith) * std::cos(azimuth);
+        muon.dir[1] = std::sin(zenith) * std::sin(azimuth);
+        muon.dir[2] = -std::cos(zenith);
+        double length = distanceToExit(muon.start, muon.dir, detector.radius, detector.halfHeight);
+        for (int i = 0; i < 3; i++) {
+            muon.stop[i] = muon.start[i] + length * muon.dir[i];
+        }
+        muon.time = 0;
+        muon.energy = 1000 + 9000 * uniform(random);
+        muon.momentum = std::sqrt(muon.energy * muon.energy - 105.66 * 105.66);
+        event.muons.push_back(muon);
+
+        // The light reaching a PMT at longitudinal distance z along the track and perpendicular distance rho from it
+        // at the angle theta to the track is emitted at s = z - rho / tan(theta)
+        for (std::size_t row = 0; row < geometry.size(); row++) {
+            double offset = config.angleSpread * (0.2 + 0.8 * uniform(random));
+            double theta = cherenkovAngle + (uniform(random) < 0.5 ? -offset : offset);
+            double toPMT[3] = {geometry.x[row] - muon.start[0], geometry.y[row] - muon.start[1],
+                               geometry.z[row] - muon.start[2]};
+            double z = toPMT[0] * muon.dir[0] + toPMT[1] * muon.dir[1] + toPMT[2] * muon.dir[2];
+            double r2 = toPMT[0] * toPMT[0] + toPMT[1] * toPMT[1] + toPMT[2] * toPMT[2];
+            double rho = std::sqrt(std::fmax(0., r2 - z * z));
+            double s = z - rho / std::tan(theta);
+            if (s < 0 || s > length) {
+                continue;
+            }
+            // The light has to arrive on the front of the PMT
+            double fromEmission[3] = {toPMT[0] - s * muon.dir[0], toPMT[1] - s * muon.dir[1],
+                                      toPMT[2] - s * muon.dir[2]};
+            double facing = fromEmission[0] * geometry.dirX[row] + fromEmission[1] * geometry.dirY[row] +
+                            fromEmission[2] * geometry.dirZ[row];
+            if (facing >= 0 || uniform(random) >= config.detectionProbability) {
+                continue;
+            }
+            double pathLength = std::sqrt((z - s) * (z - s) + rho * rho);
+            event.tubeId.push_back(row + 1);
+            event.time.push_back(muon.time + (s + ng * pathLength) / cVac);
+            event.charge.push_back(1 + uniform(random));
+            if (truth) {
+                truth->muon.push_back(muonN);
+                truth->emission.push_back(s);
+            }
+        }
+    }
+
+    // Dark noise
+    std::poisson_distribution<int> nNoise(config.noiseHitsPerEvent > 0 ? config.noiseHitsPerEvent : 1);
+    int nNoiseHits = config.noiseHitsPerEvent > 0 ? nNoise(random) : 0;
+    std::uniform_int_distribution<std::size_t> tube(1, geometry.size());
+    for (int i = 0; i < nNoiseHits; i++) {
+        event.tubeId.push_back(tube(random));
+        event.time.push_back(config.noiseWindow * uniform(random));
+        event.charge.push_back(uniform(random) + 0.5);
+        if (truth) {
+            truth->muon.push_back(-1);
+            truth->emission.push_back(NAN);
+        }
+    }
+}
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+
+#include "track_census.h"
+
+namespace {
+
+bool parseNumber(const std::string &field, double &value) {
+    char *end = nullptr;
+    value = std::strtod(field.c_str(), &end);
+    return !field.empty() && *end == '\0';
+}
+
+bool noCut(const std::string &field) { return field.empty() || field == "*"; }
+
+} // namespace
+
+bool parseTrackSelection(const std::string &spec, TrackSelection &selection) {
+    std::vector<std::string> fields;
+    std::istringstream stream(spec);
+    std::string field;
+    while (std::getline(stream, field, ':')) {
+        fields.push_back(field);
+    }
+    if (!spec.empty() && spec.back() == ':') {
+        fields.push_back("");
+    }
+    if (fields.size() != 4 && !(fields.size() == 5 && fields[4] == "not")) {
+        return false;
+    }
+
+    TrackSelection parsed;
+    parsed.name = fields[0];
+    if (parsed.name.empty() || !std::all_of(parsed.name.begin(), parsed.name.end(), [](unsigned char c) {
+            return std::isalnum(c) || c == '-' || c == '_';
+        })) {
+        return false;
+    }
+    if (!noCut(fields[1])) {
+        char *end = nullptr;
+        long pdg = std::strtol(fields[1].c_str(), &end, 10);
+        if (*end != '\0') {
+            return false;
+        }
+        parsed.anyParticle = false;
+        parsed.pdg = int(pdg);
+    }
+    if (!noCut(fields[2]) && !parseNumber(fields[2], parsed.minEnergy)) {
+        return false;
+    }
+    if (!noCut(fields[3]) && !parseNumber(fields[3], parsed.maxEnergy)) {
+        return false;
+    }
+    parsed.inverted = fields.size() == 5;
+    selection = parsed;
+    return true;
+}
+
+TrackCensus::TrackCensus(const std::vector<TrackSelection> &selections)
+    : cuts(selections), passed(selections.size(), 0), byParticle(selections.size()), byProcess(selections.size()) {}
+
+std::uint32_t TrackCensus::internProcess(const std::string &name) {
+    auto found = std::find(processNames.begin(), processNames.end(), name);
+    if (found != processNames.end()) {
+        return std::uint32_t(found - processNames.begin());
+    }
+    processNames.push_back(name);
+    return std::uint32_t(processNames.size() - 1);
+}
+
+void TrackCensus::nameProcess(int processCode, const std::string &name) {
+    processIds[processCode] = internProcess(name);
+}
+
+void TrackCensus::add(int pdg, double energy, int processCode) {
+    tracks++;
+    // The process is only looked up once, and only if a selection wants it
+    const std::uint32_t *process = nullptr;
+    for (std::size_t selection = 0; selection < cuts.size(); selection++) {
+        if (!cuts[selection].accepts(pdg, energy)) {
+            continue;
+        }
+        if (!process) {
+            process = processIds.find(processCode);
+        }
+        passed[selection]++;
+        byParticle[selection][pdg]++;
+        byProcess[selection][*process]++;
+    }
+}
+
+void TrackCensus::merge(const TrackCensus &other) {
+    tracks += other.tracks;
+    // The other census interned its processes in the order it met them, so translate its IDs through the names
+    std::vector<std::uint32_t> translated(other.processNames.size());
+    for (std::size_t id = 0; id < other.processNames.size(); id++) {
+        translated[id] = internProcess(other.processNames[id]);
+    }
+    other.processIds.forEach([&](int code, std::uint32_t id) {
+        if (!processIds.find(code)) {
+            processIds[code] = translated[id];
+        }
+    });
+    for (std::size_t selection = 0; selection < cuts.size() && selection < other.cuts.size(); selection++) {
+        passed[selection] += other.passed[selection];
+        byParticle[selection].merge(other.byParticle[selection]);
+        other.byProcess[selection].forEach(
+            [&](std::uint32_t id, std::uint64_t count) { byProcess[selection][translated[id]] += count; });
+    }
+}
+
+std::vector<std::pair<int, std::uint64_t>> TrackCensus::particleCounts(std::size_t selection) const {
+    std::vector<std::pair<int, std::uint64_t>> counts;
+    byParticle[selection].forEach([&](int pdg, std::uint64_t count) { counts.emplace_back(pdg, count); });
+    std::sort(counts.begin(), counts.end());
+    return counts;
+}
+
+std::vector<std::pair<std::string, std::uint64_t>> TrackCensus::processCounts(std::size_t selection) const {
+    std::vector<std::pair<std::string, std::uint64_t>> counts;
+    byProcess[selection].forEach(
+        [&](std::uint32_t id, std::uint64_t count) { counts.emplace_back(processNames[id], count); });
+    std::sort(counts.begin(), counts.end());
+    return counts;
+}
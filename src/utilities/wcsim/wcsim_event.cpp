@@ -0,0 +1,99 @@
+#include <string>
+
+#include "TClonesArray.h"
+#include "TFile.h"
+#include "TTree.h"
+
+#include "WCSimRootEvent.hh"
+
+#include "logger.h"
+#include "wcsim_event.h"
+
+TTree *getWCSimTree(TFile *WCSimFile) {
+    // Example: Access a specific tree by name and cycle
+    const char *treeName = "wcsimT"; // Replace with desired tree name
+    int cycle = 1;                   // Replace with desired cycle number
+
+    // Construct the name with cycle and fetch the tree
+    std::string treeWithCycle = std::string(treeName) + ";" + std::to_string(cycle);
+    TTree *wcSimTree = (TTree *)WCSimFile->Get(treeWithCycle.c_str());
+    if (!wcSimTree) {
+        LOG_ERROR("Tree '" << treeName << "' with cycle " << cycle << " not found!");
+    }
+    return wcSimTree;
+}
+
+namespace {
+
+bool sameMuon(const MuonKinematics &a, const MuonKinematics &b) {
+    return a.time == b.time && a.start[0] == b.start[0] && a.start[1] == b.start[1] && a.start[2] == b.start[2] &&
+           a.dir[0] == b.dir[0] && a.dir[1] == b.dir[1] && a.dir[2] == b.dir[2];
+}
+
+} // namespace
+
+void readFlatEvent(WCSimRootEvent *wcSimRootSuperEvent, std::int64_t entry, FlatEvent &event, bool antiMuons) {
+    event.clear();
+    event.entry = entry;
+    int nTriggers = wcSimRootSuperEvent->GetNumberOfEvents();
+    if (nTriggers < 1 || !wcSimRootSuperEvent->GetTrigger(0)) {
+        LOG_WARNING("Entry " << entry << " has no trigger");
+        return;
+    }
+    double firstTriggerTime = wcSimRootSuperEvent->GetTrigger(0)->GetHeader()->GetDate();
+
+    for (int triggerN = 0; triggerN < nTriggers; triggerN++) {
+        WCSimRootTrigger *wcSimRootEvent = wcSimRootSuperEvent->GetTrigger(triggerN);
+        if (!wcSimRootEvent) {
+            continue;
+        }
+
+        // The primary muons, a track that is listed by more than one trigger is only taken once
+        int nTracks = wcSimRootEvent->GetNtrack();
+        for (int trackN = 0; trackN < nTracks; trackN++) {
+            TObject *element = wcSimRootEvent->GetTracks()->At(trackN);
+            WCSimRootTrack *wcSimRootTrack = (WCSimRootTrack *)(element);
+            int pdg = wcSimRootTrack->GetIpnu();
+            if (wcSimRootTrack->GetFlag() != 0 || wcSimRootTrack->GetParenttype() != 0 ||
+                (pdg != 13 && !(antiMuons && pdg == -13))) {
+                continue;
+            }
+            MuonKinematics muon;
+            for (int i = 0; i < 3; i++) {
+                muon.start[i] = wcSimRootTrack->GetStart(i);
+                muon.stop[i] = wcSimRootTrack->GetStop(i);
+                muon.dir[i] = wcSimRootTrack->GetDir(i);
+            }
+            muon.time = wcSimRootTrack->GetTime();
+            muon.energy = wcSimRootTrack->GetE();
+            muon.momentum = wcSimRootTrack->GetP();
+            bool seen = false;
+            for (const MuonKinematics &other : event.muons) {
+                seen |= sameMuon(muon, other);
+            }
+            if (!seen) {
+                event.muons.push_back(muon);
+            }
+        }
+
+        // The digitised hits, with the times of the later triggers moved onto the clock of the first
+        int nHits = wcSimRootEvent->GetNcherenkovdigihits();
+        int nDigitHitSlots = wcSimRootEvent->GetNcherenkovdigihits_slots();
+        if (!nHits) {
+            continue;
+        }
+        double timeOffset = wcSimRootEvent->GetHeader()->GetDate() - firstTriggerTime;
+        TClonesArray *digitHits = wcSimRootEvent->GetCherenkovDigiHits();
+        for (int NdigiHitEvent = 0; NdigiHitEvent < nDigitHitSlots; NdigiHitEvent++) {
+            TObject *digitHit = digitHits->At(NdigiHitEvent);
+            if (!digitHit) {
+                continue;
+            }
+            WCSimRootCherenkovDigiHit *wcSimRootCherenkovDigiHit =
+                dynamic_cast<WCSimRootCherenkovDigiHit *>(digitHit);
+            event.tubeId.push_back(wcSimRootCherenkovDigiHit->GetTubeId());
+            event.time.push_back(wcSimRootCherenkovDigiHit->GetT() + timeOffset);
+            event.charge.push_back(wcSimRootCherenkovDigiHit->GetQ());
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#include "TFile.h"
+#include "TTree.h"
+
+#include "WCSimRootGeom.hh"
+
+#include "logger.h"
+#include "wcsim_geometry.h"
+
+bool buildPMTGeometry(WCSimRootGeom *geo, PMTGeometry &geometry) {
+    if (!geo) {
+        return false;
+    }
+    int nPMTs = geo->GetWCNumPMT();
+    geometry.resize(nPMTs);
+    for (int i = 0; i < nPMTs; i++) {
+        // GetPMT returns a copy so take it once per tube here rather than once per hit in the event loop
+        WCSimRootPMT pmt = geo->GetPMT(i);
+        int tubeId = pmt.GetTubeNo();
+        if (!geometry.contains(tubeId)) {
+            LOG_ERROR("PMT " << i << " has tube number " << tubeId << " outside of the geometry");
+            return false;
+        }
+        std::size_t row = PMTGeometry::index(tubeId);
+        geometry.x[row] = pmt.GetPosition(0);
+        geometry.y[row] = pmt.GetPosition(1);
+        geometry.z[row] = pmt.GetPosition(2);
+        geometry.dirX[row] = pmt.GetOrientation(0);
+        geometry.dirY[row] = pmt.GetOrientation(1);
+        geometry.dirZ[row] = pmt.GetOrientation(2);
+        geometry.cylLoc[row] = pmt.GetCylLoc();
+    }
+    return true;
+}
+
+bool loadPMTGeometry(TFile *WCSimFile, PMTGeometry &geometry) {
+    TTree *wcSimGeoTree = (TTree *)WCSimFile->Get("wcsimGeoT");
+    if (!wcSimGeoTree) {
+        LOG_ERROR("Geometry tree not found!");
+        return false;
+    }
+    WCSimRootGeom *geo = 0;
+    wcSimGeoTree->SetBranchAddress("wcsimrootgeom", &geo);
+    wcSimGeoTree->GetEntry(0);
+    bool ok = buildPMTGeometry(geo, geometry);
+    wcSimGeoTree->ResetBranchAddresses();
+    delete geo;
+    return ok;
+}
+
+std::uint64_t geometrySourceKey(TFile *WCSimFile) {
+    TTree *wcSimGeoTree = (TTree *)WCSimFile->Get("wcsimGeoT");
+    if (!wcSimGeoTree) {
+        return 0;
+    }
+    // 64 bit FNV-1a over the three sizes
+    std::uint64_t key = 14695981039346656037ull;
+    for (std::int64_t value : {std::int64_t(wcSimGeoTree->GetEntries()), std::int64_t(wcSimGeoTree->GetTotBytes()),
+                               std::int64_t(wcSimGeoTree->GetZipBytes())}) {
+        for (int byte = 0; byte < 8; byte++) {
+            key = (key ^ ((std::uint64_t(value) >> (8 * byte)) & 0xff)) * 1099511628211ull;
+        }
+    }
+    return key;
+}
+
+bool loadPMTGeometry(TFile *WCSimFile, const std::string &sidecarPath, PMTGeometry &geometry) {
+    std::uint64_t sourceKey = geometrySourceKey(WCSimFile);
+    if (!sidecarPath.empty() && readPMTGeometry(geometry, sidecarPath, sourceKey)) {
+        LOG_INFO("Loaded " << geometry.size() << " PMTs from " << sidecarPath);
+        return true;
+    }
+    if (!loadPMTGeometry(WCSimFile, geometry)) {
+        return false;
+    }
+    LOG_INFO("Loaded " << geometry.size() << " PMTs from the geometry tree");
+    if (!sidecarPath.empty()) {
+        if (writePMTGeometry(geometry, sidecarPath, sourceKey)) {
+            LOG_INFO("Wrote geometry cache " << sidecarPath);
+        } else {
+            LOG_WARNING("Failed to write geometry cache " << sidecarPath);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,111 @@
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+#include "TBranch.h"
+#include "TEnv.h"
+#include "TFile.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+#include "WCSimRootEvent.hh"
+
+#include "logger.h"
+#include "wcsim_event.h"
+#include "wcsim_input.h"
+
+void WCSimInputStats::merge(const WCSimInputStats &other) {
+    entries += other.entries;
+    fileBytes += other.fileBytes;
+    readCalls += other.readCalls;
+    unpackedBytes += other.unpackedBytes;
+    readSeconds += other.readSeconds;
+}
+
+std::string WCSimInputStats::summary() const {
+    double perEvent = entries ? 1. / entries : 0;
+    std::ostringstream summary;
+    summary << std::fixed << std::setprecision(2) << "Read " << entries << " entries, " << fileBytes / 1e6
+            << " MB from storage in " << readCalls << " requests and " << unpackedBytes / 1e6 << " MB unpacked, "
+            << fileBytes * perEvent / 1e3 << " kB and " << readSeconds * perEvent * 1e3
+            << " ms in GetEntry per event";
+    return summary.str();
+}
+
+void setWCSimPrefetch(bool enabled) { gEnv->SetValue("TFile.AsyncPrefetching", enabled ? 1 : 0); }
+
+void setUpWCSimThreads(bool prefetch) {
+    ROOT::EnableThreadSafety();
+    setWCSimPrefetch(prefetch);
+}
+
+WCSimInput::~WCSimInput() { close(); }
+
+bool WCSimInput::open(const std::string &path, const WCSimInputConfig &config, std::int64_t firstEntry,
+                      std::int64_t lastEntry) {
+    close();
+    input.reset(TFile::Open(path.c_str(), "READ"));
+    if (!input || input->IsZombie()) {
+        LOG_ERROR("Failed to open WCSim file " << path);
+        input.reset();
+        return false;
+    }
+    tree = getWCSimTree(input.get());
+    eventBranch = tree ? tree->GetBranch("wcsimrootevent") : nullptr;
+    if (!eventBranch) {
+        LOG_ERROR("Failed to get WCSimRootEvent branch from " << path);
+        close();
+        return false;
+    }
+    nEntries = tree->GetEntries();
+
+    superEvent = new WCSimRootEvent();
+    eventBranch->SetAddress(&superEvent);
+
+    // Train the cache on the event branch straight away, as the entries to be read are known
+    if (config.cacheSizeMB > 0) {
+        if (lastEntry < 0 || lastEntry > nEntries) {
+            lastEntry = nEntries;
+        }
+        tree->SetCacheSize(Long64_t(config.cacheSizeMB * 1024 * 1024));
+        tree->AddBranchToCache(eventBranch, true);
+        tree->SetCacheEntryRange(firstEntry, lastEntry);
+        tree->StopCacheLearningPhase();
+    } else {
+        tree->SetCacheSize(0);
+    }
+
+    openBytes = input->GetBytesRead();
+    openCalls = input->GetReadCalls();
+    return true;
+}
+
+bool WCSimInput::read(std::int64_t entry) {
+    auto start = std::chrono::steady_clock::now();
+    // Only the event branch is read, the other branches of the tree are left alone
+    int bytes = eventBranch->GetEntry(entry);
+    counters.readSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (bytes <= 0) {
+        LOG_ERROR("Failed to read entry " << entry << " of " << input->GetName());
+        return false;
+    }
+    counters.entries++;
+    counters.unpackedBytes += bytes;
+    return true;
+}
+
+void WCSimInput::close() {
+    if (input) {
+        counters.fileBytes += input->GetBytesRead() - openBytes;
+        counters.readCalls += input->GetReadCalls() - openCalls;
+    }
+    if (tree) {
+        tree->ResetBranchAddresses();
+        tree = nullptr;
+        eventBranch = nullptr;
+    }
+    delete superEvent;
+    superEvent = nullptr;
+    input.reset();
+    nEntries = 0;
+}